@@ -0,0 +1,88 @@
+/*
+ * arena.c - Bump-pointer arena for per-request strings
+ */
+/* $begin arena.c */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+static char *align_up(char *p)
+{
+    return (char *)(((uintptr_t)p + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+}
+
+void arena_init(arena_t *a, void *buf, size_t size)
+{
+    a->first = buf;
+    a->first_size = size;
+    a->blocks = NULL;
+    a->spare = NULL;
+    a->ptr = buf;
+    a->end = a->ptr + size;
+}
+
+void *arena_alloc(arena_t *a, size_t n)
+{
+    arena_block_t *b;
+    size_t size;
+    char *p = align_up(a->ptr);
+
+    if (p <= a->end && n <= (size_t)(a->end - p)) {
+        a->ptr = p + n;
+        return p;
+    }
+    /* 넘쳤다: 남겨 둔 블록에 들어가면 그것을, 아니면 직전 블록의 두 배(최소 ARENA_BLOCK, n 이 들어갈 만큼)로 새 블록 */
+    if ((b = a->spare) != NULL && n + ARENA_ALIGN <= b->size)
+        a->spare = NULL;
+    else {
+        size = a->blocks ? a->blocks->size * 2 : ARENA_BLOCK;
+        while (size < n + ARENA_ALIGN)
+            size *= 2;
+        if ((b = malloc(sizeof(arena_block_t) + size)) == NULL)
+            return NULL;
+        b->size = size;
+    }
+    b->next = a->blocks;
+    a->blocks = b;
+    p = align_up((char *)(b + 1));
+    a->end = (char *)(b + 1) + b->size;
+    a->ptr = p + n;
+    return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n)
+{
+    char *p;
+
+    if ((p = arena_alloc(a, n + 1)) == NULL)
+        return NULL;
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+void arena_reset(arena_t *a)
+{
+    arena_block_t *b;
+
+    while ((b = a->blocks) != NULL) {
+        a->blocks = b->next;
+        if (a->spare == NULL || b->size > a->spare->size) {
+            free(a->spare);
+            a->spare = b;
+        }
+        else
+            free(b);
+    }
+    a->ptr = a->first;
+    a->end = a->first + a->first_size;
+}
+
+void arena_free(arena_t *a)
+{
+    arena_reset(a);
+    free(a->spare);
+    a->spare = NULL;
+}
+/* $end arena.c */
@@ -0,0 +1,42 @@
+/*
+ * arena.h - Bump-pointer arena for per-request strings
+ *
+ * 요청 하나를 처리하는 동안 생기는 문자열(요청 헤드 사본, URI 조각, upstream 요청)을
+ * 포인터만 밀어서 나눠 준다. 하나씩 해제하지 않고 요청이 끝나면 통째로 되감는다.
+ * 첫 블록은 호출자가 준 버퍼(보통 요청 구조체 안)이고, 넘치면 블록을 더 할당한다.
+ * 되감을 때 넘친 블록 중 가장 큰 것 하나는 남겨 두어, 큰 요청이 이어져도 요청마다 malloc/free 하지 않는다.
+ */
+/* $begin arena.h */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16          /* 나눠 주는 주소의 정렬 */
+#define ARENA_BLOCK 4096        /* 넘칠 때 더 할당하는 블록의 최소 크기 */
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;                /* 뒤따르는 데이터 크기 */
+} arena_block_t;
+
+typedef struct {
+    char *ptr, *end;            /* 지금 블록에서 다음에 나눠 줄 자리와 끝 */
+    char *first;                /* 첫 블록 (호출자 소유) */
+    size_t first_size;
+    arena_block_t *blocks;      /* 넘쳐서 할당한 블록들. 최근 것이 앞 */
+    arena_block_t *spare;       /* 되감을 때 남겨 둔 가장 큰 블록. 다음에 넘치면 먼저 쓴다 */
+} arena_t;
+
+void arena_init(arena_t *a, void *buf, size_t size);
+/* n 바이트. 메모리가 모자라면 NULL */
+void *arena_alloc(arena_t *a, size_t n);
+/* s[0..n) 의 NUL 로 끝나는 사본 */
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+/* 나눠 준 것을 모두 버린다. 가장 큰 블록만 남기고 넘친 블록은 해제하고, 첫 블록부터 다시 쓴다 */
+void arena_reset(arena_t *a);
+/* 남겨 둔 블록까지 모두 해제한다. 첫 블록(호출자 소유)은 건드리지 않는다 */
+void arena_free(arena_t *a);
+
+#endif /* __ARENA_H__ */
+/* $end arena.h */
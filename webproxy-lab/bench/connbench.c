@@ -0,0 +1,153 @@
+/*
+ * connbench.c - Proxy memory per idle client connection
+ *
+ * usage: connbench <proxy-pid> <proxy-port> <nconns> [url]
+ *
+ * 실행 중인 프록시에 연결을 nconns 개 열어 두고, 그 전후의 프록시 RSS
+ * (/proc/<pid>/status 의 VmRSS) 차이를 연결 수로 나눠 보고한다.
+ *   1. 아무것도 보내지 않은 연결
+ *   2. url 을 주면 각 연결로 keep-alive 요청을 하나씩 보내고 응답을 다 받은 뒤,
+ *      루프로 돌아가 다음 요청을 기다리는 연결
+ * url 의 응답에는 Content-Length 가 있어야 한다. 소켓 버퍼 같은 커널 메모리는
+ * RSS 에 잡히지 않는다. 10만 연결을 재려면 양쪽 프로세스의 fd 한도
+ * (ulimit -Hn)와 net.ipv4.ip_local_port_range 가 그만큼 넉넉해야 한다.
+ */
+#define _GNU_SOURCE  /* strcasestr() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SETTLE_US 500000   /* 프록시가 이벤트를 다 처리할 때까지 기다리는 시간 */
+
+static long rss_kb(int pid)
+{
+    char path[64], line[256];
+    long kb = -1;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp))
+        if (!strncmp(line, "VmRSS:", 6))
+            kb = strtol(line + 6, NULL, 10);
+    fclose(fp);
+    return kb;
+}
+
+static int dial(int port)
+{
+    struct sockaddr_in sa;
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 요청 하나를 보내고 헤더와 Content-Length 만큼의 본문을 읽는다. 성공하면 0 */
+static int fetch(int fd, const char *req, size_t reqlen)
+{
+    char buf[65536], *end, *cl;
+    size_t have = 0, need;
+    ssize_t n;
+
+    if (write(fd, req, reqlen) != (ssize_t)reqlen)
+        return -1;
+    while (1) {
+        if ((n = read(fd, buf + have, sizeof(buf) - 1 - have)) <= 0)
+            return -1;
+        have += n;
+        buf[have] = '\0';
+        if ((end = strstr(buf, "\r\n\r\n")) != NULL)
+            break;
+        if (have == sizeof(buf) - 1)
+            return -1;
+    }
+    if ((cl = strcasestr(buf, "\r\nContent-Length:")) == NULL || cl > end)
+        return -1;
+    need = (end + 4 - buf) + strtoul(cl + 17, NULL, 10);
+    while (have < need) {
+        if ((n = read(fd, buf, sizeof(buf))) <= 0)
+            return -1;
+        have += n;
+    }
+    return 0;
+}
+
+static void report(const char *what, long before, long after, int n)
+{
+    printf("%-28s RSS %8ld -> %8ld KB   %7.0f bytes/conn\n",
+           what, before, after, (after - before) * 1024.0 / n);
+}
+
+int main(int argc, char **argv)
+{
+    int pid, port, n, i, *fds;
+    long base, idle, used;
+    char req[4096];
+    size_t reqlen = 0;
+    struct rlimit rl;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <proxy-pid> <proxy-port> <nconns> [url]\n", argv[0]);
+        exit(1);
+    }
+    pid = atoi(argv[1]);
+    port = atoi(argv[2]);
+    n = atoi(argv[3]);
+    if (argc > 4)
+        reqlen = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", argv[4]);
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if ((fds = malloc(n * sizeof(int))) == NULL || (base = rss_kb(pid)) < 0) {
+        fprintf(stderr, "cannot read /proc/%d/status\n", pid);
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++)
+        if ((fds[i] = dial(port)) < 0) {
+            fprintf(stderr, "connect failed after %d connections\n", i);
+            n = i;
+            break;
+        }
+    if (n == 0)
+        exit(1);
+    usleep(SETTLE_US);
+    idle = rss_kb(pid);
+    report("idle, no request", base, idle, n);
+
+    if (reqlen > 0) {
+        for (i = 0; i < n; i++)
+            if (fetch(fds[i], req, reqlen) < 0) {
+                fprintf(stderr, "request on connection %d failed\n", i);
+                exit(1);
+            }
+        usleep(SETTLE_US);
+        used = rss_kb(pid);
+        report("idle after one request", base, used, n);
+    }
+
+    for (i = 0; i < n; i++)
+        close(fds[i]);
+    free(fds);
+    return 0;
+}
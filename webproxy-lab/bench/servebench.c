@@ -0,0 +1,171 @@
+/*
+ * servebench.c - Static file throughput and CPU cost per serving strategy
+ *
+ * usage: servebench [MB]   (경우마다 보내는 양, 기본 256MB)
+ *
+ * tiny 의 정적 파일 전략(sendfile, splice, mmap, read)마다 godzilla.jpg,
+ * godzilla.mpg 와 만들어 둔 4KB ~ 16MB 파일을 루프백 TCP 로 되풀이해 보낸다.
+ * tiny 처럼 응답마다 파일을 열고 헤드를 붙인다. 받는 쪽은 자식 프로세스가 읽어 버린다.
+ * 보내는 프로세스의 처리량(GB/s)과 1GB 당 CPU 시간(user+sys)을 보고한다.
+ * ../tiny 의 파일을 쓰므로 bench 디렉터리에서 실행한다.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "serve.h"
+
+static double now_sec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double cpu_sec(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* 루프백 연결 하나를 만들고, 자식이 받는 쪽 끝을 EOF 까지 읽어 버린다. 보내는 쪽 fd */
+static int open_sink(pid_t *pid)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    int lfd, fd, cfd;
+    static char buf[1 << 18];
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&sa, &len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || (cfd = accept(lfd, NULL, NULL)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    close(lfd);
+    if ((*pid = fork()) == 0) {
+        close(fd);
+        while (read(cfd, buf, sizeof(buf)) > 0)
+            ;
+        _exit(0);
+    }
+    close(cfd);
+    return fd;
+}
+
+/* 파일을 reps 번 보내고 처리량과 CPU 를 출력한다 */
+static void run(const char *label, const char *path, size_t size, const serve_strategy_t *s, size_t total)
+{
+    char hdr[256];
+    size_t hdrlen, reps, i;
+    double t0, c0, t, c, gb;
+    serve_job_t job;
+    pid_t pid;
+    int fd, filefd;
+
+    hdrlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n"
+                      "Connection: close\r\nContent-length: %zu\r\nContent-type: text/plain\r\n\r\n", size);
+    reps = total / size > 0 ? total / size : 1;
+    fd = open_sink(&pid);
+    t0 = now_sec();
+    c0 = cpu_sec();
+    for (i = 0; i < reps; i++) {
+        if ((filefd = open(path, O_RDONLY)) < 0) {
+            perror(path);
+            exit(1);
+        }
+        job.hdr.iov_base = hdr;
+        job.hdr.iov_len = hdrlen;
+        job.filefd = filefd;
+        job.off = 0;
+        job.len = size;
+        job.zc = NULL;
+        if (s->send(fd, &job) != 0) {  /* 블로킹 소켓이라 한 번에 다 보낸다 */
+            perror(s->name);
+            exit(1);
+        }
+        close(filefd);
+    }
+    shutdown(fd, SHUT_WR);
+    waitpid(pid, NULL, 0);
+    t = now_sec() - t0;
+    c = cpu_sec() - c0;
+    close(fd);
+    gb = (double)reps * (size + hdrlen) / 1e9;
+    printf("%-14s %10zu  %-9s %8.2f GB/s %8.3f CPU s/GB\n", label, size, s->name, gb / t, c / gb);
+}
+
+/* size 바이트짜리 파일을 만든다. 페이지 캐시에 올라간 상태로 잰다 */
+static void make_file(char *path, size_t size)
+{
+    char buf[65536];
+    size_t n;
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    memset(buf, 'x', sizeof(buf));
+    for (; size > 0; size -= n) {
+        n = size < sizeof(buf) ? size : sizeof(buf);
+        if (write(fd, buf, n) != (ssize_t)n) {
+            perror("write");
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *given[] = {"../tiny/godzilla.jpg", "../tiny/godzilla.mpg"};
+    static const size_t sizes[] = {4096, 65536, 1 << 20, 16 << 20};
+    char paths[4][32];
+    size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+    const serve_strategy_t *s;
+    int i;
+    off_t size;
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("%-14s %10s  %-9s %13s %17s\n", "file", "bytes", "strategy", "throughput", "cpu");
+    for (i = 0; i < 2; i++) {
+        int fd = open(given[i], O_RDONLY);
+
+        if (fd < 0 || (size = lseek(fd, 0, SEEK_END)) < 0) {
+            perror(given[i]);
+            exit(1);
+        }
+        close(fd);
+        for (s = serve_strategies; s->name; s++)
+            run(strrchr(given[i], '/') + 1, given[i], size, s, total);
+    }
+    for (i = 0; i < 4; i++) {
+        strcpy(paths[i], "/tmp/servebenchXXXXXX");
+        make_file(paths[i], sizes[i]);
+        for (s = serve_strategies; s->name; s++)
+            run("generated", paths[i], sizes[i], s, total);
+        unlink(paths[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * timerbench.c - Timing wheel insert/cancel/expire throughput
+ *
+ * usage: timerbench [ntimers]   (기본 1,000,000개)
+ *
+ * 실제 시계를 쓰지 않고 가상 시각으로 휠을 돌려서 휠 자체 비용만 잰다.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "timer.h"
+
+#define TICK_MS    10
+#define MAX_TMO_MS (10 * 60 * 1000)   /* 최대 10분짜리 타임아웃 */
+
+static size_t fired, late, early;
+static uint64_t clock_ms;
+
+/* arg 는 기대 만료 시각. 일찍 터지거나 한 tick 넘게 늦으면 센다 */
+static void on_expire(tw_timer_t *t, void *arg)
+{
+    uint64_t want = *(uint64_t *)arg;
+
+    fired++;
+    if (clock_ms < want)
+        early++;
+    else if (clock_ms >= want + TICK_MS)
+        late++;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, size_t ops, double sec)
+{
+    printf("%-8s %9zu ops %8.3f s %8.2f Mops/s %7.1f ns/op\n",
+           what, ops, sec, ops / sec / 1e6, sec * 1e9 / ops);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000, i, ncancel;
+    tw_wheel_t *w = malloc(sizeof(*w));
+    tw_timer_t *timers = malloc(n * sizeof(*timers));
+    uint64_t *when = malloc(n * sizeof(*when));
+    double t0;
+
+    if (!w || !timers || !when) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    srand(1);
+    for (i = 0; i < n; i++) {
+        when[i] = 1 + (uint64_t)rand() % MAX_TMO_MS;
+        tw_timer_init(&timers[i], on_expire, &when[i]);
+    }
+    tw_init(w, TICK_MS, 0);
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++)
+        tw_add_at(w, &timers[i], when[i]);
+    report("insert", n, now_sec() - t0);
+
+    /* 요청마다 idle 타이머를 다시 거는 패턴: 취소 + 재삽입 */
+    t0 = now_sec();
+    for (i = 0; i < n; i++)
+        tw_add_at(w, &timers[i], when[i]);
+    report("rearm", n, now_sec() - t0);
+
+    ncancel = n / 2;
+    t0 = now_sec();
+    for (i = 0; i < ncancel; i++)
+        tw_del(w, &timers[i * 2]);
+    report("cancel", ncancel, now_sec() - t0);
+
+    /* 남은 타이머가 모두 만료될 때까지 1 tick 씩 가상 시각을 진행 */
+    t0 = now_sec();
+    for (clock_ms = 0; w->count > 0; clock_ms += TICK_MS)
+        tw_advance(w, clock_ms);
+    report("expire", fired, now_sec() - t0);
+
+    if (fired != n - ncancel || early || late) {
+        fprintf(stderr, "expired %zu timers (expected %zu), %zu early, %zu late\n",
+                fired, n - ncancel, early, late);
+        exit(1);
+    }
+    free(when);
+    free(timers);
+    free(w);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * bufchain.c - Reference-counted chains of immutable buffer chunks
+ */
+/* $begin bufchain.c */
+#include <stdlib.h>
+#include <string.h>
+#include "bufchain.h"
+
+bufchain_t *bc_new(void)
+{
+    bufchain_t *b;
+
+    if ((b = malloc(sizeof(bufchain_t))) == NULL)
+        return NULL;
+    b->refs = 1;
+    b->len = 0;
+    b->head = b->tail = NULL;
+    b->link = &b->head;
+    return b;
+}
+
+int bc_append(bufchain_t *b, const void *p, size_t n)
+{
+    bc_chunk_t *c = b->tail;
+    size_t take;
+
+    while (n > 0) {
+        if (c != NULL && c->len == c->cap && c->cap < BC_CHUNK) {
+            /* 덜 자란 마지막 청크는 두 배씩(최대 BC_CHUNK) 키운다. 아직 나누기 전이라 옮겨도 된다 */
+            take = c->cap * 2 > c->len + n ? c->cap * 2 : c->len + n;
+            if (take > BC_CHUNK)
+                take = BC_CHUNK;
+            if ((c = realloc(c, sizeof(bc_chunk_t) + take)) == NULL)
+                return -1;
+            c->cap = take;
+            *b->link = b->tail = c;
+        }
+        else if (c == NULL || c->len == c->cap) {
+            /* 작은 내용에 청크 하나를 통째로 쓰지 않도록 필요한 만큼만(최대 BC_CHUNK) */
+            take = n < BC_CHUNK ? n : BC_CHUNK;
+            if ((c = malloc(sizeof(bc_chunk_t) + take)) == NULL)
+                return -1;
+            c->next = NULL;
+            c->len = 0;
+            c->cap = take;
+            if (b->tail) {
+                b->tail->next = c;
+                b->link = &b->tail->next;
+            }
+            else
+                b->head = c;
+            b->tail = c;
+        }
+        take = c->cap - c->len < n ? c->cap - c->len : n;
+        memcpy(c->data + c->len, p, take);
+        c->len += take;
+        b->len += take;
+        p = (const char *)p + take;
+        n -= take;
+    }
+    return 0;
+}
+
+void bc_ref(bufchain_t *b)
+{
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+}
+
+void bc_unref(bufchain_t *b)
+{
+    bc_chunk_t *c;
+
+    if (b == NULL || __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    while ((c = b->head) != NULL) {
+        b->head = c->next;
+        free(c);
+    }
+    free(b);
+}
+
+int bc_iov(const bc_chunk_t **pos, struct iovec *iov, int max)
+{
+    const bc_chunk_t *c;
+    int n = 0;
+
+    for (c = *pos; c && n < max; c = c->next) {
+        iov[n].iov_base = (void *)c->data;
+        iov[n].iov_len = c->len;
+        n++;
+    }
+    *pos = c;
+    return n;
+}
+/* $end bufchain.c */
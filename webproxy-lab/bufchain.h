@@ -0,0 +1,47 @@
+/*
+ * bufchain.h - Reference-counted chains of immutable buffer chunks
+ *
+ * 응답 본문을 고정 크기 청크의 사슬로 담는다. 다 채운 뒤에는 고치지 않으므로
+ * 여러 스레드가 락 없이 같은 청크에서 바로 writev 할 수 있다. 쓰는 쪽은 참조를
+ * 하나 잡고 보내고, 다 보내면 놓는다. 마지막 참조가 사라질 때 청크가 해제된다.
+ */
+/* $begin bufchain.h */
+#ifndef __BUFCHAIN_H__
+#define __BUFCHAIN_H__
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define BC_CHUNK 16384          /* 청크 하나의 최대 데이터 크기 */
+
+typedef struct bc_chunk {
+    struct bc_chunk *next;
+    size_t len, cap;
+    char data[];
+} bc_chunk_t;
+
+typedef struct {
+    int refs;                   /* 원자적으로 바꾼다 */
+    size_t len;                 /* 모든 청크의 데이터 합 */
+    bc_chunk_t *head, *tail;
+    bc_chunk_t **link;          /* tail 을 가리키는 포인터 (head 또는 앞 청크의 next). 키울 때 고친다 */
+} bufchain_t;
+
+/* 참조 하나를 가진 빈 사슬. 메모리가 모자라면 NULL */
+bufchain_t *bc_new(void);
+/*
+ * 끝에 덧붙인다. 다른 스레드와 나누기 전에만 부를 것. 0, 메모리가 모자라면 -1.
+ * 마지막 청크를 BC_CHUNK 까지 키워 채운 뒤에야 새 청크를 만들므로, 조금씩 나눠 붙여도
+ * 청크 수는 len / BC_CHUNK 를 올림한 만큼이다
+ */
+int bc_append(bufchain_t *b, const void *p, size_t n);
+void bc_ref(bufchain_t *b);
+void bc_unref(bufchain_t *b);
+/*
+ * *pos 부터 청크를 iov 에 최대 max 개 싣고 실은 개수를 돌려준다. *pos 는 다음에 실을
+ * 청크로 옮겨지고, 사슬 끝까지 실었으면 NULL. 처음에는 *pos = b->head 로 부른다
+ */
+int bc_iov(const bc_chunk_t **pos, struct iovec *iov, int max);
+
+#endif /* __BUFCHAIN_H__ */
+/* $end bufchain.h */
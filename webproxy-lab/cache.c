@@ -0,0 +1,129 @@
+/*
+ * cache.c - LRU cache of proxied responses, keyed by request URI
+ */
+/* $begin cache.c */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+
+typedef struct entry {
+    char *key;
+    bufchain_t *head, *body;
+    size_t size;                        /* head->len + body->len */
+    struct entry *hnext;                /* 버킷 사슬 */
+    struct entry *prev, *next;          /* LRU 목록. 앞이 최근 */
+} entry_t;
+
+static entry_t *buckets[CACHE_BUCKETS];
+static entry_t *lru_head, *lru_tail;
+static size_t cache_size, cache_capacity;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static entry_t **bucket(const char *key)
+{
+    uint32_t h = 2166136261u;           /* FNV-1a */
+
+    while (*key)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    return &buckets[h & (CACHE_BUCKETS - 1)];
+}
+
+static void lru_unlink(entry_t *e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        lru_head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        lru_tail = e->prev;
+}
+
+static void lru_push(entry_t *e)
+{
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head)
+        lru_head->prev = e;
+    else
+        lru_tail = e;
+    lru_head = e;
+}
+
+/* 목록과 버킷에서 떼고 캐시의 참조를 놓는다. cache_mutex 를 잡고 부른다 */
+static void evict(entry_t *e)
+{
+    entry_t **pp;
+
+    for (pp = bucket(e->key); *pp != e; pp = &(*pp)->hnext)
+        ;
+    *pp = e->hnext;
+    lru_unlink(e);
+    cache_size -= e->size;
+    bc_unref(e->head);
+    bc_unref(e->body);
+    free(e->key);
+    free(e);
+}
+
+void cache_init(size_t capacity)
+{
+    cache_capacity = capacity;
+}
+
+int cache_lookup(const char *key, bufchain_t **head, bufchain_t **body)
+{
+    entry_t *e;
+
+    pthread_mutex_lock(&cache_mutex);
+    for (e = *bucket(key); e; e = e->hnext)
+        if (!strcmp(e->key, key))
+            break;
+    if (e) {
+        lru_unlink(e);
+        lru_push(e);
+        bc_ref(e->head);
+        bc_ref(e->body);
+        *head = e->head;
+        *body = e->body;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return e != NULL;
+}
+
+void cache_insert(const char *key, bufchain_t *head, bufchain_t *body)
+{
+    entry_t *e, *old, **pp;
+    size_t size = head->len + body->len;
+
+    if (size > cache_capacity || (e = malloc(sizeof(entry_t))) == NULL)
+        return;
+    if ((e->key = strdup(key)) == NULL) {
+        free(e);
+        return;
+    }
+    bc_ref(head);
+    bc_ref(body);
+    e->head = head;
+    e->body = body;
+    e->size = size;
+
+    pthread_mutex_lock(&cache_mutex);
+    pp = bucket(key);
+    for (old = *pp; old; old = old->hnext)
+        if (!strcmp(old->key, key)) {
+            evict(old);
+            break;
+        }
+    while (cache_size + size > cache_capacity)
+        evict(lru_tail);
+    e->hnext = *pp;
+    *pp = e;
+    lru_push(e);
+    cache_size += size;
+    pthread_mutex_unlock(&cache_mutex);
+}
+/* $end cache.c */
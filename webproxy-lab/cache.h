@@ -0,0 +1,26 @@
+/*
+ * cache.h - LRU cache of proxied responses, keyed by request URI
+ *
+ * 항목은 응답 헤드와 본문을 각각 bufchain 으로 가진다. 찾을 때는 락 안에서 참조만
+ * 잡아 돌려주고, 보내는 일은 호출자가 락 밖에서 청크를 바로 writev 해서 한다.
+ * 용량을 넘으면 오래 안 쓴 항목부터 캐시의 참조를 놓는다. 보내는 중인 스레드가
+ * 참조를 들고 있으면 청크는 그 스레드가 놓을 때 해제된다.
+ */
+/* $begin cache.h */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include "bufchain.h"
+
+#define CACHE_BUCKETS 1024      /* 해시 버킷 수 (2의 거듭제곱) */
+
+/* 헤드와 본문을 합쳐 capacity 바이트까지 담는다 */
+void cache_init(size_t capacity);
+/* 있으면 두 사슬의 참조를 하나씩 잡아 넘기고 1, 없으면 0. 호출자가 bc_unref 한다 */
+int cache_lookup(const char *key, bufchain_t **head, bufchain_t **body);
+/* 캐시가 자기 참조를 잡아 넣는다. 같은 키가 있으면 바꾼다. 너무 크면 넣지 않는다 */
+void cache_insert(const char *key, bufchain_t *head, bufchain_t *body);
+
+#endif /* __CACHE_H__ */
+/* $end cache.h */
@@ -0,0 +1,156 @@
+/*
+ * chunked.c - Incremental Transfer-Encoding: chunked codec
+ *
+ * 각 입력 바이트는 한 번만 본다. 청크 데이터는 바이트 단위로 보지 않고
+ * 남은 길이만큼 한 번에 구간으로 넘긴다.
+ */
+/* $begin chunked.c */
+#include "chunked.h"
+#include "scan.h"
+
+static int hexval(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+void chunked_init(chunked_t *d)
+{
+    d->state = CH_SIZE;
+    d->digits = 0;
+    d->remaining = 0;
+}
+
+/* 크기 줄이 끝났다: 0 이면 trailer, 아니면 데이터 */
+static void size_line_end(chunked_t *d)
+{
+    if (d->digits == 0)
+        d->state = CH_ERROR;
+    else
+        d->state = d->remaining ? CH_DATA : CH_TRAILER;
+}
+
+size_t chunked_decode(chunked_t *d, const char *in, size_t len,
+                      const char **data, size_t *datalen)
+{
+    size_t i = 0, n;
+    const char *nl;
+    int v;
+    char c;
+
+    *datalen = 0;
+    while (i < len && d->state != CH_DONE && d->state != CH_ERROR) {
+        if (d->state == CH_DATA) {
+            n = len - i < d->remaining ? len - i : (size_t)d->remaining;
+            *data = in + i;
+            *datalen = n;
+            chunked_skip(d, n);
+            return i + n;
+        }
+        if (d->state == CH_TRAILER_LINE) {   /* trailer 줄 내용은 보지 않고 줄 끝으로 건너뛴다 */
+            if ((nl = scan_chr(in + i, len - i, '\n')) == NULL)
+                return len;
+            i = nl - in;
+        }
+        c = in[i++];
+        switch (d->state) {
+        case CH_SIZE:
+            if ((v = hexval(c)) >= 0) {
+                if (d->digits++ >= 15) {   /* 2^60 이상은 받지 않는다 */
+                    d->state = CH_ERROR;
+                    break;
+                }
+                d->remaining = d->remaining * 16 + v;
+            }
+            else if (c == ';' || c == ' ' || c == '\t')
+                d->state = CH_EXT;
+            else if (c == '\r')
+                d->state = CH_SIZE_LF;
+            else if (c == '\n')
+                size_line_end(d);
+            else
+                d->state = CH_ERROR;
+            break;
+        case CH_EXT:
+            if (c == '\r')
+                d->state = CH_SIZE_LF;
+            else if (c == '\n')
+                size_line_end(d);
+            break;
+        case CH_SIZE_LF:
+            if (c == '\n')
+                size_line_end(d);
+            else
+                d->state = CH_ERROR;
+            break;
+        case CH_DATA_CR:
+            if (c == '\r')
+                d->state = CH_DATA_LF;
+            else if (c == '\n')
+                chunked_init(d);
+            else
+                d->state = CH_ERROR;
+            break;
+        case CH_DATA_LF:
+            if (c == '\n')
+                chunked_init(d);
+            else
+                d->state = CH_ERROR;
+            break;
+        case CH_TRAILER:
+            if (c == '\r')
+                d->state = CH_TRAILER_LF;
+            else if (c == '\n')
+                d->state = CH_DONE;
+            else
+                d->state = CH_TRAILER_LINE;
+            break;
+        case CH_TRAILER_LINE:
+            if (c == '\n')
+                d->state = CH_TRAILER;
+            break;
+        case CH_TRAILER_LF:
+            d->state = c == '\n' ? CH_DONE : CH_ERROR;
+            break;
+        }
+    }
+    return i;
+}
+
+void chunked_skip(chunked_t *d, size_t n)
+{
+    d->remaining -= n;
+    if (d->remaining == 0)
+        d->state = CH_DATA_CR;
+}
+
+int chunked_done(const chunked_t *d)
+{
+    if (d->state == CH_DONE)
+        return 1;
+    return d->state == CH_ERROR ? -1 : 0;
+}
+
+size_t chunked_head(char *buf, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    char tmp[16];
+    size_t len = 0, i = 0;
+
+    do {
+        tmp[i++] = hex[n & 0xf];
+        n >>= 4;
+    } while (n);
+    while (i > 0)
+        buf[len++] = tmp[--i];
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return len;
+}
+/* $end chunked.c */
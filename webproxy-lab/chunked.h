@@ -0,0 +1,59 @@
+/*
+ * chunked.h - Incremental Transfer-Encoding: chunked codec
+ *
+ * 디코더는 입력을 조각 단위로 받아도 이어서 파싱하는 상태 기계다.
+ * 입력을 고치거나 메모리를 할당하지 않고, 본문 바이트가 있는 구간만 알려 준다.
+ * 청크 데이터 안에 있을 때는 남은 길이(remaining)를 알 수 있으므로, 호출자가
+ * 그 구간을 직접(splice 등으로) 옮기고 chunked_skip 으로 건너뛸 수 있다.
+ */
+/* $begin chunked.h */
+#ifndef __CHUNKED_H__
+#define __CHUNKED_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    CH_SIZE,            /* 청크 크기(16진수) */
+    CH_EXT,             /* 청크 확장 (무시) */
+    CH_SIZE_LF,
+    CH_DATA,            /* 청크 데이터: remaining 바이트 남음 */
+    CH_DATA_CR,
+    CH_DATA_LF,
+    CH_TRAILER,         /* trailer 줄의 시작 */
+    CH_TRAILER_LINE,
+    CH_TRAILER_LF,      /* 마지막 빈 줄의 LF */
+    CH_DONE,
+    CH_ERROR
+};
+
+typedef struct {
+    int state;
+    int digits;             /* 지금 크기 줄에서 읽은 16진수 자릿수 */
+    uint64_t remaining;     /* 현재 청크에 남은 데이터 바이트 */
+} chunked_t;
+
+#define CHUNKED_HEAD_MAX 20             /* 16진수 16자리 + CRLF + NUL */
+#define CHUNKED_LAST "0\r\n\r\n"
+
+void chunked_init(chunked_t *d);
+
+/*
+ * in[0..len) 을 이어서 파싱하고 소비한 바이트 수를 반환한다.
+ * 청크 데이터 구간을 만나면 *data, *datalen 에 담고 그 직후에서 멈춘다(없으면 *datalen = 0).
+ * 끝(CH_DONE)이나 오류(CH_ERROR)에서도 멈추며, 그 뒤의 바이트는 소비하지 않는다.
+ */
+size_t chunked_decode(chunked_t *d, const char *in, size_t len,
+                      const char **data, size_t *datalen);
+
+/* CH_DATA 상태에서 호출자가 직접 옮긴 n 바이트(<= remaining)를 건너뛴다 */
+void chunked_skip(chunked_t *d, size_t n);
+
+/* 1: 본문 끝, -1: 형식 오류, 0: 더 읽어야 함 */
+int chunked_done(const chunked_t *d);
+
+/* 인코더: n 바이트 청크의 머리("%x\r\n")를 buf 에 쓰고 길이를 반환. 데이터 뒤에는 "\r\n" */
+size_t chunked_head(char *buf, size_t n);
+
+#endif /* __CHUNKED_H__ */
+/* $end chunked.h */
@@ -23,6 +23,8 @@
  */
 /* $begin csapp.c */
 #include "csapp.h"
+#include <poll.h>
+#include <linux/errqueue.h>
 
 /************************** 
  * Error-handling functions
@@ -792,6 +794,283 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write an array of buffers (unbuffered) with as
+ *    few writev() calls as possible. A short write may stop in the
+ *    middle of a buffer; the array is then advanced past the bytes
+ *    already written and writev() is called again, so iov is modified
+ *    in place. Returns the total number of bytes, -1 on error.
+ */
+/* $begin rio_writev */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    ssize_t nwritten = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+	total += iov[i].iov_len;
+    while (1) {
+	/* Skip the buffers written so far (and empty ones) */
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt == 0)
+	    break;
+	iov->iov_base = (char *)iov->iov_base + nwritten;
+	iov->iov_len -= nwritten;
+	if ((nwritten = writev(fd, iov, iovcnt < UIO_MAXIOV ? iovcnt : UIO_MAXIOV)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+    }
+    return total;
+}
+/* $end rio_writev */
+
+/*
+ * rio_writev_nb - Write an array of buffers without blocking. Writes
+ *    until the socket would block and records how far it got: *iovp
+ *    and *iovcntp are advanced past the bytes written (the buffer
+ *    where a short write stopped is trimmed in place), so the next
+ *    call, typically after EPOLLOUT, resumes exactly there. Sockets
+ *    are written with MSG_DONTWAIT and need not be O_NONBLOCK; other
+ *    descriptors must be. Returns the number of bytes still to write
+ *    (0 when done), -1 on error.
+ */
+/* $begin rio_writev_nb */
+ssize_t rio_writev_nb(int fd, struct iovec **iovp, int *iovcntp)
+{
+    struct iovec *iov = *iovp;
+    int iovcnt = *iovcntp, i;
+    struct msghdr msg;
+    ssize_t nwritten;
+    size_t left = 0;
+
+    while (1) {
+	while (iovcnt > 0 && iov->iov_len == 0) { /* Skip empty buffers */
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt == 0)
+	    break;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt < UIO_MAXIOV ? iovcnt : UIO_MAXIOV;
+	nwritten = sendmsg(fd, &msg, MSG_DONTWAIT);
+	if (nwritten < 0 && errno == ENOTSOCK)
+	    nwritten = writev(fd, iov, msg.msg_iovlen);
+	if (nwritten < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;           /* Would block: save progress */
+	    return -1;           /* errno set by sendmsg()/writev() */
+	}
+	while (nwritten > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (nwritten > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    *iovp = iov;
+    *iovcntp = iovcnt;
+    for (i = 0; i < iovcnt; i++)
+	left += iov[i].iov_len;
+    return left;
+}
+/* $end rio_writev_nb */
+
+/*
+ * rio_zcinit - Start a socket's zero-copy state: SO_ZEROCOPY is turned
+ *    on by the first large send, and no sends are outstanding.
+ */
+/* $begin rio_zcinit */
+void rio_zcinit(rio_zc_t *zp)
+{
+    zp->rio_zc_on = 0;
+    zp->rio_zc_pending = 0;
+}
+/* $end rio_zcinit */
+
+/*
+ * rio_zc_reap_nb - Collect the completions already queued for the
+ *    MSG_ZEROCOPY sends in zp, without blocking. Completions arrive on
+ *    the socket error queue as ranges of send ids (and raise POLLERR).
+ *    If the kernel reports that it had to copy anyway (loopback, no
+ *    NIC support), later sends on this socket just copy. Returns the
+ *    number of sends whose buffers the kernel may still read, -1 on
+ *    error.
+ */
+/* $begin rio_zc_reap_nb */
+int rio_zc_reap_nb(int fd, rio_zc_t *zp)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    unsigned int done;
+
+    while (zp->rio_zc_pending > 0) {
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;      /* Nothing more completed yet */
+	    return -1;
+	}
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+	    if (!(cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) &&
+		!(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+		continue;
+	    serr = (struct sock_extended_err *)CMSG_DATA(cm);
+	    if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+		errno = serr->ee_errno;
+		return -1;
+	    }
+	    if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+		zp->rio_zc_on = -1;
+	    done = serr->ee_data - serr->ee_info + 1;
+	    zp->rio_zc_pending -= (done < zp->rio_zc_pending) ? done : zp->rio_zc_pending;
+	}
+    }
+    return zp->rio_zc_pending;
+}
+/* $end rio_zc_reap_nb */
+
+/*
+ * rio_zc_wait - Block until the kernel has released every buffer handed
+ *    to it by the MSG_ZEROCOPY sends in zp. The caller may then free or
+ *    change them. Returns 0, or -1 on error.
+ */
+/* $begin rio_zc_wait */
+int rio_zc_wait(int fd, rio_zc_t *zp)
+{
+    struct pollfd pfd;
+
+    while (rio_zc_reap_nb(fd, zp) > 0) {
+	pfd.fd = fd;        /* Error queue empty: wait for POLLERR */
+	pfd.events = 0;
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+	    return -1;
+    }
+    return zp->rio_zc_pending > 0 ? -1 : 0;
+}
+/* $end rio_zc_wait */
+
+/*
+ * rio_writev_zc_nb - rio_writev_nb, zero-copy for large writes. While
+ *    at least RIO_ZC_THRESHOLD bytes remain they are sent with
+ *    MSG_ZEROCOPY, so the kernel pins the user pages instead of copying
+ *    them; smaller writes, sockets without SO_ZEROCOPY and sends the
+ *    kernel has no room to track (ENOBUFS) are copied as usual. Like
+ *    rio_writev_nb it stops when the socket would block and advances
+ *    *iovp and *iovcntp so the next call resumes there. Each zero-copy
+ *    send is counted in zp: the bytes written must stay unchanged until
+ *    rio_zc_reap_nb reports 0 pending (or rio_zc_wait returns). Reap on
+ *    POLLERR/EPOLLERR, which signals completions. Returns the number of
+ *    bytes still to write (0 when done), -1 on error.
+ */
+/* $begin rio_writev_zc_nb */
+ssize_t rio_writev_zc_nb(int fd, struct iovec **iovp, int *iovcntp, rio_zc_t *zp)
+{
+    struct iovec *iov = *iovp;
+    int iovcnt = *iovcntp, optval = 1, i;
+    struct msghdr msg;
+    ssize_t nwritten;
+    size_t left = 0;
+    unsigned int pending;
+
+    for (i = 0; i < iovcnt; i++)
+	left += iov[i].iov_len;
+    if (zp->rio_zc_pending > 0 && rio_zc_reap_nb(fd, zp) < 0)
+	return -1;
+    if (zp->rio_zc_on == 0)
+	zp->rio_zc_on = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) < 0 ? -1 : 1;
+
+    while (left >= RIO_ZC_THRESHOLD && zp->rio_zc_on > 0) {
+	while (iov->iov_len == 0) { /* Skip empty buffers */
+	    iov++;
+	    iovcnt--;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt < UIO_MAXIOV ? iovcnt : UIO_MAXIOV;
+	if ((nwritten = sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_DONTWAIT)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		goto save;       /* Would block: save progress */
+	    if (errno != ENOBUFS)
+		return -1;       /* errno set by sendmsg() */
+	    pending = zp->rio_zc_pending; /* Out of optmem: release and */
+	    if (rio_zc_reap_nb(fd, zp) < 0) /* retry, or copy if none is */
+		return -1;                  /* done yet */
+	    if (zp->rio_zc_pending < pending)
+		continue;
+	    break;
+	}
+	zp->rio_zc_pending++;
+	left -= nwritten;
+	while (nwritten > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (nwritten > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    *iovp = iov;
+    *iovcntp = iovcnt;
+    return rio_writev_nb(fd, iovp, iovcntp);
+
+save:
+    *iovp = iov;
+    *iovcntp = iovcnt;
+    return left;
+}
+/* $end rio_writev_zc_nb */
+
+/*
+ * rio_writev_zc - Robustly write an array of buffers (unbuffered) with
+ *    rio_writev_zc_nb, waiting for the socket to drain whenever it would
+ *    block, so it also works on O_NONBLOCK sockets. It does not wait for
+ *    completions: the buffers must stay unchanged until rio_zc_wait.
+ *    The iov array may be modified. Returns the number of bytes
+ *    written, -1 on error.
+ */
+/* $begin rio_writev_zc */
+ssize_t rio_writev_zc(int fd, struct iovec *iov, int iovcnt, rio_zc_t *zp)
+{
+    struct pollfd pfd;
+    ssize_t left, total = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+	total += iov[i].iov_len;
+    while ((left = rio_writev_zc_nb(fd, &iov, &iovcnt, zp)) > 0) {
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+	    return -1;
+    }
+    return left < 0 ? -1 : total;
+}
+/* $end rio_writev_zc */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -802,13 +1081,46 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
  *    read() if the internal buffer is empty.
  */
 /* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
-{
-    int cnt;
+/*
+ * Default-size buffers released by rio_freeb are kept on a free list
+ * shared by all threads, so a connection that drops its buffer while
+ * idle gets one back without going through malloc.
+ */
+struct rio_freebuf {
+    struct rio_freebuf *next;
+};
+static struct rio_freebuf *rio_pool;
+static int rio_pool_cnt;
+static pthread_mutex_t rio_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Allocate the internal buffer on first use */
+static int rio_allocb(rio_t *rp)
+{
+    struct rio_freebuf *fb = NULL;
+
+    if (rp->rio_buf != NULL)
+	return 0;
+    if (rp->rio_size == RIO_BUFSIZE) {
+	pthread_mutex_lock(&rio_pool_mutex);
+	if ((fb = rio_pool) != NULL) {
+	    rio_pool = fb->next;
+	    rio_pool_cnt--;
+	}
+	pthread_mutex_unlock(&rio_pool_mutex);
+    }
+    if ((rp->rio_buf = fb ? (char *)fb : malloc(rp->rio_size)) == NULL)
+	return -1;
+    rp->rio_bufptr = rp->rio_buf;
+    return 0;
+}
 
+/* Refill the internal buffer if it is empty. Returns rio_cnt, 0 on EOF */
+static ssize_t rio_refill(rio_t *rp)
+{
+    if (rio_allocb(rp) < 0)
+	return -1;
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
+	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_size);
 	if (rp->rio_cnt < 0) {
 	    if (errno != EINTR) /* Interrupted by sig handler return */
 		return -1;
@@ -818,6 +1130,16 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 	else 
 	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
     }
+    return rp->rio_cnt;
+}
+
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+    ssize_t rc;
+
+    if ((rc = rio_refill(rp)) <= 0)
+	return rc;
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -832,16 +1154,51 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 
 /*
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
+ *    The buffer itself is allocated by the first read and released by
+ *    rio_freeb; a rio_t that was read from must be freed before it is
+ *    reinitialized or goes out of scope.
  */
 /* $begin rio_readinitb */
 void rio_readinitb(rio_t *rp, int fd) 
+{
+    rio_readinitb_size(rp, fd, RIO_BUFSIZE);
+}
+
+void rio_readinitb_size(rio_t *rp, int fd, size_t size) 
 {
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
-    rp->rio_bufptr = rp->rio_buf;
+    rp->rio_buf = rp->rio_bufptr = NULL;
+    rp->rio_size = size > 0 ? size : RIO_BUFSIZE;
 }
 /* $end rio_readinitb */
 
+/*
+ * rio_freeb - Release the internal buffer. Unread bytes are discarded.
+ *    The rio_t stays usable: the next read allocates a buffer again, so
+ *    a long-lived connection can drop its buffer while it sits idle.
+ */
+/* $begin rio_freeb */
+void rio_freeb(rio_t *rp)
+{
+    struct rio_freebuf *fb = (struct rio_freebuf *)rp->rio_buf;
+
+    if (fb != NULL && rp->rio_size == RIO_BUFSIZE) {
+	pthread_mutex_lock(&rio_pool_mutex);
+	if (rio_pool_cnt < RIO_POOL_MAX) {
+	    fb->next = rio_pool;
+	    rio_pool = fb;
+	    rio_pool_cnt++;
+	    fb = NULL;
+	}
+	pthread_mutex_unlock(&rio_pool_mutex);
+    }
+    free(fb);
+    rp->rio_buf = rp->rio_bufptr = NULL;
+    rp->rio_cnt = 0;
+}
+/* $end rio_freeb */
+
 /*
  * rio_readnb - Robustly read n bytes (buffered)
  */
@@ -866,33 +1223,312 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
+ *    The line end is located with memchr in the internal buffer and
+ *    the line is copied in whole pieces; the buffer is refilled only
+ *    when it runs dry.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
+
+    while (n + 1 < maxlen) {
+	if ((rc = rio_refill(rp)) < 0)
+	    return -1;	  /* Error */
+	if (rc == 0) {
+	    if (n == 0)
 		return 0; /* EOF, no data read */
 	    else
 		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+	}
+
+	/* Copy up to and including the newline, if it is in the buffer */
+	cnt = rp->rio_cnt;
+	if (cnt > maxlen - 1 - n)
+	    cnt = maxlen - 1 - n;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp + n, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	n += cnt;
+	if (nl)
+	    break;
     }
-    *bufp = 0;
-    return n-1;
+    bufp[n] = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_fillb - Read more bytes into the internal buffer without
+ *    consuming any. Unread bytes are moved to the front of the buffer
+ *    only when there is no room after them, and the buffer is doubled
+ *    when it is full of unread bytes, so rio_bufptr may change. Callers
+ *    bound how much they leave unread. Returns the number of bytes
+ *    added, 0 on EOF, -1 on error.
+ */
+/* $begin rio_fillb */
+/* Make room after the unread bytes and return where new bytes go */
+static char *rio_roomb(rio_t *rp)
+{
+    char *end, *buf;
+
+    if (rio_allocb(rp) < 0)
+	return NULL;
+    if (rp->rio_cnt == 0)
+	rp->rio_bufptr = rp->rio_buf;
+    end = rp->rio_bufptr + rp->rio_cnt;
+    if (end == rp->rio_buf + rp->rio_size) {
+	if (rp->rio_bufptr == rp->rio_buf) { /* Full of unread bytes: grow */
+	    if ((buf = realloc(rp->rio_buf, 2 * rp->rio_size)) == NULL)
+		return NULL;
+	    rp->rio_buf = rp->rio_bufptr = buf;
+	    rp->rio_size *= 2;
+	}
+	else {
+	    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	    rp->rio_bufptr = rp->rio_buf;
+	}
+	end = rp->rio_buf + rp->rio_cnt;
+    }
+    return end;
+}
+
+ssize_t rio_fillb(rio_t *rp)
+{
+    ssize_t n;
+    char *end;
+
+    if ((end = rio_roomb(rp)) == NULL)
+	return -1;
+    while ((n = read(rp->rio_fd, end, rp->rio_buf + rp->rio_size - end)) < 0)
+	if (errno != EINTR) /* Interrupted by sig handler return */
+	    return -1;
+    rp->rio_cnt += n;
+    return n;
+}
+/* $end rio_fillb */
+
+/*
+ * rio_fillb_nb - rio_fillb that never blocks. If nothing can be read
+ *    yet it returns -1 with errno EAGAIN and rp is left as it was
+ *    (apart from compaction), so an event loop can keep a partly
+ *    received request in the buffer, with its read cursor, and call
+ *    again on the next readiness event. Sockets are read with
+ *    MSG_DONTWAIT and need not be O_NONBLOCK; other descriptors must
+ *    be. Returns the number of bytes added, 0 on EOF, -1 on error.
+ */
+/* $begin rio_fillb_nb */
+ssize_t rio_fillb_nb(rio_t *rp)
+{
+    ssize_t n;
+    size_t room;
+    char *end;
+
+    if ((end = rio_roomb(rp)) == NULL)
+	return -1;
+    room = rp->rio_buf + rp->rio_size - end;
+    while ((n = recv(rp->rio_fd, end, room, MSG_DONTWAIT)) < 0) {
+	if (errno == ENOTSOCK)
+	    n = read(rp->rio_fd, end, room);
+	if (n >= 0)
+	    break;
+	if (errno != EINTR) /* EAGAIN: nothing yet */
+	    return -1;
+    }
+    rp->rio_cnt += n;
+    return n;
+}
+/* $end rio_fillb_nb */
+
+/*
+ * rio_peekb - Return the unread bytes in the internal buffer without
+ *    consuming them, refilling it first if it is empty. *bufp points
+ *    into the buffer and stays valid until the next read on rp.
+ *    Returns the number of bytes, 0 on EOF, -1 on error.
+ */
+/* $begin rio_peekb */
+ssize_t rio_peekb(rio_t *rp, char **bufp)
+{
+    ssize_t rc;
+
+    if (rp->rio_cnt == 0 && (rc = rio_fillb(rp)) <= 0)
+	return rc;
+    *bufp = rp->rio_bufptr;
+    return rp->rio_cnt;
+}
+/* $end rio_peekb */
+
+/*
+ * rio_peeklineb - Return the next text line in place, without copying
+ *    or consuming it. The line includes its newline; it is cut at maxlen
+ *    bytes if no newline comes first, and at EOF the rest of the input
+ *    is returned. The line is not NUL-terminated. The buffer is
+ *    compacted or grown when the line spans its end. Returns the line
+ *    length, 0 on EOF, -1 on error; call rio_consumeb to move past it.
+ */
+/* $begin rio_peeklineb */
+ssize_t rio_peeklineb(rio_t *rp, char **linep, size_t maxlen)
+{
+    size_t scanned = 0, lim;
+    ssize_t rc;
+    char *nl;
+
+    while (1) {
+	lim = (size_t)rp->rio_cnt < maxlen ? (size_t)rp->rio_cnt : maxlen;
+	if (lim > scanned &&
+	    (nl = memchr(rp->rio_bufptr + scanned, '\n', lim - scanned)) != NULL) {
+	    lim = nl - rp->rio_bufptr + 1;
+	    break;
+	}
+	if (lim == maxlen)     /* No newline within maxlen bytes */
+	    break;
+	scanned = lim;
+	if ((rc = rio_fillb(rp)) < 0)
+	    return -1;
+	if (rc == 0)           /* EOF */
+	    break;
+    }
+    *linep = rp->rio_bufptr;
+    return lim;
+}
+/* $end rio_peeklineb */
+
+/*
+ * rio_consumeb - Move past n (<= rio_cnt) peeked bytes
+ */
+/* $begin rio_consumeb */
+void rio_consumeb(rio_t *rp, size_t n)
+{
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+}
+/* $end rio_consumeb */
+
+/*
+ * rio_writeinitb - Associate a descriptor with an empty output buffer.
+ *    Appends go to a small inline buffer first and move to a heap
+ *    buffer that doubles as needed, so a response is assembled in one
+ *    linear pass. Nothing is written until rio_flushb.
+ */
+/* $begin rio_writeinitb */
+void rio_writeinitb(rio_writer_t *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_len = 0;
+    wp->rio_size = RIO_WRITER_INLINE;
+    wp->rio_buf = wp->rio_inline;
+}
+/* $end rio_writeinitb */
+
+/*
+ * rio_writefreeb - Release the heap buffer, if any. Unflushed bytes
+ *    are discarded.
+ */
+/* $begin rio_writefreeb */
+void rio_writefreeb(rio_writer_t *wp)
+{
+    if (wp->rio_buf != wp->rio_inline)
+	free(wp->rio_buf);
+    rio_writeinitb(wp, wp->rio_fd);
+}
+/* $end rio_writefreeb */
+
+/* Make room for n more bytes */
+static int rio_reserveb(rio_writer_t *wp, size_t n)
+{
+    size_t size = wp->rio_size;
+    char *buf;
+
+    if (wp->rio_len + n <= size)
+	return 0;
+    while (size < wp->rio_len + n)
+	size *= 2;
+    if (wp->rio_buf == wp->rio_inline) {
+	if ((buf = malloc(size)) == NULL)
+	    return -1;
+	memcpy(buf, wp->rio_buf, wp->rio_len);
+    }
+    else if ((buf = realloc(wp->rio_buf, size)) == NULL)
+	return -1;
+    wp->rio_buf = buf;
+    wp->rio_size = size;
+    return 0;
+}
+
+/*
+ * rio_writeb - Append n bytes to the output buffer. Returns 0, or -1
+ *    if the buffer cannot grow.
+ */
+/* $begin rio_writeb */
+int rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n)
+{
+    if (rio_reserveb(wp, n) < 0)
+	return -1;
+    memcpy(wp->rio_buf + wp->rio_len, usrbuf, n);
+    wp->rio_len += n;
+    return 0;
+}
+/* $end rio_writeb */
+
+/*
+ * rio_printfb - Append printf-style formatted text to the output
+ *    buffer. The text is formatted in place after the bytes already
+ *    there; if it does not fit, the buffer grows and it is formatted
+ *    once more. Returns 0, or -1 on error.
+ */
+/* $begin rio_printfb */
+int rio_vprintfb(rio_writer_t *wp, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int n;
+
+    va_copy(aq, ap);
+    n = vsnprintf(wp->rio_buf + wp->rio_len, wp->rio_size - wp->rio_len, fmt, aq);
+    va_end(aq);
+    if (n < 0)
+	return -1;
+    if ((size_t)n >= wp->rio_size - wp->rio_len) {   /* Truncated: grow */
+	if (rio_reserveb(wp, n + 1) < 0)
+	    return -1;
+	vsnprintf(wp->rio_buf + wp->rio_len, n + 1, fmt, ap);
+    }
+    wp->rio_len += n;
+    return 0;
+}
+
+int rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+{
+    va_list ap;
+    int rc;
+
+    va_start(ap, fmt);
+    rc = rio_vprintfb(wp, fmt, ap);
+    va_end(ap);
+    return rc;
+}
+/* $end rio_printfb */
+
+/*
+ * rio_flushb - Write everything in the output buffer with one
+ *    rio_writen and empty it. Returns the number of bytes written,
+ *    -1 on error.
+ */
+/* $begin rio_flushb */
+ssize_t rio_flushb(rio_writer_t *wp)
+{
+    ssize_t n = wp->rio_len;
+
+    if (n > 0 && rio_writen(wp->rio_fd, wp->rio_buf, n) < 0)
+	return -1;
+    wp->rio_len = 0;
+    return n;
+}
+/* $end rio_flushb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -911,6 +1547,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt) 
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -934,6 +1576,39 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+void Rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n)
+{
+    if (rio_writeb(wp, usrbuf, n) < 0)
+	unix_error("Rio_writeb error");
+}
+
+void Rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+{
+    va_list ap;
+    int rc;
+
+    va_start(ap, fmt);
+    rc = rio_vprintfb(wp, fmt, ap);
+    va_end(ap);
+    if (rc < 0)
+	unix_error("Rio_printfb error");
+}
+
+void Rio_flushb(rio_writer_t *wp)
+{
+    if (rio_flushb(wp) < 0)
+	unix_error("Rio_flushb error");
+}
+
+ssize_t Rio_peeklineb(rio_t *rp, char **linep, size_t maxlen) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_peeklineb(rp, linep, maxlen)) < 0)
+	unix_error("Rio_peeklineb error");
+    return rc;
+} 
+
 /******************************** 
  * Client/server helper functions
  ********************************/
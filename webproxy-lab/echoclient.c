@@ -26,9 +26,9 @@ int main(int argc, char **argv) /* argc는 인자 개수, argv는 인자 문자
     robust IO 컨텍스트 초기화:
     - rio.rio_fd = clientfd;
     - rio.rio_cnt = 0; (내부 버퍼에 아직 데이터 없음)
-    - rio.rio_bufptr = - rio.rio_buf; (내부 버퍼 시작)
+    - rio.rio_buf = NULL; (내부 버퍼는 첫 읽기 때 RIO_BUFSIZE 만큼 할당)
     이후 Rio_readlineb 호출 시
-    - 내부 버퍼가 비어 있으면 read(rio_fd, rio.rio_buf, RIO_BUFSIZE)로 커널에서 대량 읽기
+    - 내부 버퍼가 비어 있으면 read(rio_fd, rio.rio_buf, rio.rio_size)로 커널에서 대량 읽기
     -> 사용자 내부버퍼에 채움 -> 그 안에서 줄 단위로 잘라서 반환.
     */
     Rio_readinitb(&rio, clientfd);
@@ -55,6 +55,7 @@ int main(int argc, char **argv) /* argc는 인자 개수, argv는 인자 문자
     - 커널: 이 소켓을 참조하는 FD가 더 이상 없으면 TCP 종료 시퀀스(FIN -> ACK -> ...)를 진행해 상대에 "더 이상 보낼 데이터 없음"을 알림. 
     - 상대가 아직 열려 있으면 반닫힘(half-close) 상태가 될 수 있고, 상대도 닫으면 완전 종료.
     */
+    rio_freeb(&rio); /* 내부 버퍼 해제 */
     Close(clientfd);
     
     exit(0);
@@ -3,22 +3,24 @@
 static void echo(int connfd) /* 인자 connfd는 accept()가 반환한 연결된 TCP 소켓 FD. 이 FD로 읽고 쓰면 상대 클라이언트와 통신. */
 {
     size_t n;
-    char buf[MAXLINE]; /* 한 줄을 담을 사용자 공간 버퍼. */
+    char *line; /* 내부 버퍼 안의 한 줄을 가리킨다. 사용자 공간 버퍼로 복사하지 않는다. */
 
     /*
     RIO 상태 구조체:
     - rio_fd: 대상 FD(여기선 connfd)
 	- rio_cnt: 내부 버퍼에 남은 읽기 바이트 수
 	- rio_bufptr: 내부 버퍼의 현재 읽기 위치
-	- rio_buf[RIO_BUFSIZE]: 내부 순환 버퍼(8192B)
+	- rio_buf, rio_size: 내부 버퍼(기본 8192B, 첫 읽기 때 할당)
     */
     rio_t rio;
 
     Rio_readinitb(&rio, connfd); /* RIO 컨텍스트 초기화 */
-    while ((n = Rio_readlineb(&rio, buf, MAXLINE)) != 0) { /* 한 줄씩 읽어들인다. 블로킹 동작: 서버는 클라이언트가 개행을 보낼 때까지 기다린다. */
+    while ((n = Rio_peeklineb(&rio, &line, MAXLINE)) != 0) { /* 한 줄씩 내부 버퍼 안에서 찾는다. 블로킹 동작: 서버는 클라이언트가 개행을 보낼 때까지 기다린다. */
         printf("server received %d bytes\n", (int)n);
-        Rio_writen(connfd, buf, n); /* 클라이언트에게 그대로 에코. 이때 커널은 connfd의  송신 버퍼에 데이터를 적재하고, TCP가 네트워크로 밀어낸다. */
+        Rio_writen(connfd, line, n); /* 클라이언트에게 그대로 에코. 이때 커널은 connfd의  송신 버퍼에 데이터를 적재하고, TCP가 네트워크로 밀어낸다. */
+        rio_consumeb(&rio, n); /* 보낸 줄을 지나간다 */
     }
+    rio_freeb(&rio); /* 내부 버퍼 해제 */
 }
 
 int main(int argc, char **argv) /* argv[1]에 포트를 기대 */
@@ -84,6 +86,6 @@ int main(int argc, char **argv) /* argv[1]에 포트를 기대 */
 * 5. 연결 종료
 *
 * 메모리 관점:
-* 각 클라이언트 처리 때 rio_t 구조체를 스택에 두고(지역변수), 내부 버퍼(RIO_BUFSIZE)로 커널에서 읽은 데이터를 사용자 공간 버퍼에 채움
-* -> Rio_writen으로 fd(커널의 송신 버퍼)로 밀어넣음 -> 커널이 TCP로 전송.
+* 각 클라이언트 처리 때 rio_t 구조체를 스택에 두고(지역변수), 내부 버퍼(기본 RIO_BUFSIZE, 힙)로 커널에서 데이터를 읽음
+* -> 줄을 복사하지 않고 내부 버퍼 안에서 바로 Rio_writen으로 fd(커널의 송신 버퍼)로 밀어넣음 -> 커널이 TCP로 전송.
 */
\ No newline at end of file
@@ -1,29 +1,175 @@
 #include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
+#include "timer.h"
+#include "relay.h"
+#include "respq.h"
+#include "chunked.h"
+#include "httpparse.h"
+#include "arena.h"
+#include "bufchain.h"
+#include "cache.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
-void doit(int fd);
-void read_requesthdrs(rio_t *rp, char *host_header, char *other_header);
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
-void parse_uri(char *uri, char *hostname, char *port, char *paht);
-void forward_response(int servefd, int fd);
-void reassemble(char *req, char *path, char *hostname, char *other_header);
+#define MAXEVENTS 64
+#define TICK_MS 100                  /* 타이밍 휠 해상도 */
+#define REQUEST_TIMEOUT_MS 10000     /* 요청(헤더)이 다 도착해야 하는 시간 */
+#define KEEPALIVE_TIMEOUT_MS 15000   /* 응답 후 다음 요청을 기다리는 시간 */
+#define UPSTREAM_TIMEOUT_MS 30000    /* origin 이 아무것도 보내지 않고 버틸 수 있는 시간 */
+#define MAX_PIPELINE 16              /* 한 연결에서 동시에 처리하는 요청 수 */
+#define RELAY_SEGMENT (1 << 20)      /* 본문을 이만큼 옮길 때마다 upstream 타이머를 갱신 */
+#define TUNNEL_TIMEOUT_MS 300000     /* CONNECT 터널이 아무것도 옮기지 않고 버틸 수 있는 시간 */
+#define POOL_MAX 64                  /* 재사용하려고 열어 두는 upstream 연결 수 */
+#define POOL_IDLE_MS 30000           /* 이보다 오래 놀던 upstream 연결은 버린다 */
+#define HEAD_RESERVE 96              /* 응답 헤더 끝에 붙일 본문 길이, 홉 단위 헤더 자리 */
+#define REQ_ARENA_INLINE 4096        /* 요청 구조체 안에 둔 아레나 첫 블록. 보통 요청은 여기서 끝난다 */
+#define REQ_POOL_MAX 64              /* 재사용하려고 남겨 두는 요청 구조체 수 */
+#define THREAD_STACK (256 * 1024)    /* 연결/요청 스레드 스택. 기본 8MB 예약은 동시 연결 수를 묶는다 */
+#define CACHE_IOV 16                 /* 청크 사슬을 writev 한 번에 싣는 iovec 수. 넘으면 나눠 보낸다 */
+
+/* CONNECT 이후의 연결: 루프가 두 방향을 non-blocking splice 로 옮긴다 */
+typedef struct {
+  int servefd;
+  relay_half_t up, down;   /* client -> server, server -> client */
+  int closed;              /* 끝났다. 이번 이벤트 묶음을 다 처리한 뒤 해제한다 */
+} tunnel_t;
+
+/*
+ * 클라이언트 연결. 요청을 기다리는 동안은 이벤트 루프에 머물고(idle 타이머),
+ * 요청이 오면 연결 스레드가 맡아 처리한 뒤 루프로 돌려보낸다(parked 목록).
+ * 루프에서 기다리는 동안은 rio 버퍼를 풀에 돌려주므로 놀고 있는 연결은 이 구조체 크기만 차지한다.
+ */
+typedef struct conn {
+  int fd;
+  tw_timer_t idle;      /* 루프에서 다음 요청을 기다리는 시간 */
+  tw_timer_t io;        /* 연결 스레드가 요청 헤더를 읽는 시간 */
+  rio_t rio;
+  tunnel_t *tunnel;     /* CONNECT 로 터널이 된 연결 */
+  struct conn *next;    /* parked / dead 목록 링크 */
+} conn_t;
+
+/*
+ * 파싱된 요청 1건. 파이프라인된 요청은 각자 스레드에서 동시에 처리되고,
+ * 응답은 resp 를 통해 연결의 응답 큐에 요청 순서대로 들어간다.
+ */
+typedef struct request {
+  arena_t arena;          /* 이 요청의 일시적인 문자열. 요청이 끝나면 되감는다 */
+  char arena_buf[REQ_ARENA_INLINE];
+  char *head;             /* 요청 헤드 사본(아레나). hp 의 뷰는 모두 여기를 가리킨다 */
+  hp_request_t hp;
+  char *method, *uri;     /* NUL 로 끝나는 hp 의 뷰 */
+  int http11;             /* HTTP/1.1 이상: chunked 응답을 받을 수 있다 */
+  int keepalive;
+  size_t bodylen;       /* 요청 본문 길이 (Content-Length). 없으면 0 */
+  int chunked;          /* 요청 본문이 Transfer-Encoding: chunked */
+  int expect;           /* Expect: 100-continue */
+  int private;          /* Authorization 이나 Cookie 를 실어 보낸 요청 */
+  rio_t *rio;           /* 본문을 읽을 클라이언트 rio (본문이 있는 요청만) */
+  int clientfd;         /* 본문을 읽는 동안 타임아웃이 깨울 클라이언트 소켓, 아니면 -1 */
+  int servefd;
+  int reuse;            /* 응답을 끝까지 읽었고 upstream 연결을 다시 써도 된다 */
+  tw_timer_t timer;     /* upstream 타임아웃 */
+  resp_t *resp;
+  struct request *next;   /* 재사용 목록 링크 */
+} request_t;
+
+static int epfd, wakefd;
+static pthread_attr_t thread_attr;  /* 작은 스택으로 만드는 연결/요청 스레드 속성 */
+/* 휠은 루프와 워커 스레드가 같이 쓰므로 wheel_mutex 로 보호한다 */
+static tw_wheel_t wheel;
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t loop_wakeup;   /* 루프가 epoll_wait 에서 깨어날 시각. 깨어 있으면 0 */
+/*
+ * 유휴 upstream 연결. 요청마다 새로 연결하지 않고 host:port 가 같으면 다시 쓴다.
+ * 오래된 항목은 꺼낼 때 정리한다.
+ */
+typedef struct upstream {
+  char key[MAXLINE];    /* host:port */
+  int fd;
+  uint64_t since;       /* 풀에 들어온 시각(ms) */
+  struct upstream *next;
+} upstream_t;
+
+static upstream_t *pool;
+static int pool_count;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 처리를 마치고 루프로 돌아가는 연결들 */
+static conn_t *parked;
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* 끝난 터널들. 같은 epoll_wait 묶음에 남은 이벤트가 있을 수 있어 묶음 뒤에 해제한다 */
+static conn_t *dead;
+
+/* 다 쓴 요청 구조체. 아레나를 되감아 다음 요청에 그대로 쓰므로 요청마다 malloc 하지 않는다 */
+static request_t *spare_reqs;
+static int spare_count;
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void accept_conn(int listenfd);
+static void conn_ready(conn_t *c);
+static void conn_unpark(void);
+static void conn_close(conn_t *c);
+static void conn_timeout(tw_timer_t *t, void *arg);
+static int tunnel_init(conn_t *c, int servefd);
+static void tunnel_start(conn_t *c);
+static void tunnel_ready(conn_t *c);
+static void io_timeout(tw_timer_t *t, void *arg);
+static void upstream_timeout(tw_timer_t *t, void *arg);
+static void wheel_add(tw_timer_t *t, unsigned timeout_ms);
+static void wheel_del(tw_timer_t *t);
+static void *conn_thread(void *vargp);
+static void *request_thread(void *vargp);
+static request_t *request_new(void);
+static void request_free(request_t *req);
+
+int read_request(rio_t *rio, request_t *req);
+int doit(request_t *req);
+int doit_connect(request_t *req);
+int read_requesthdrs(request_t *req);
+void clienterror(resp_t *r, char *cause, char *errnum, char *shortmsg, char *longmsg);
+static int has_token(const char *value, const char *token);
+static int parse_length(hp_str_t v, size_t *lenp);
+int parse_uri(arena_t *a, const char *uri, char **hostname, char **port, const char **path);
+int forward_response(request_t *req);
+static int relay_response(request_t *req, rio_t *rp);
+static int serve_cached(request_t *req);
+static int read_chain(rio_t *rp, bufchain_t *b, size_t len);
+static int write_chain(resp_t *r, struct iovec *iov, int n, const bc_chunk_t *c);
+static int relay_chunked(request_t *req, rio_t *rp, int raw);
+static int relay_rechunk(request_t *req, rio_t *rp);
+static int upstream_get(char *hostname, char *port);
+static void upstream_put(char *hostname, char *port, int fd);
+static ssize_t relay_body(request_t *req, size_t len);
+static int send_body(request_t *req);
+static int body_relay(request_t *req, size_t len);
+int reassemble(request_t *req, const char *path, const char *hostname, struct iovec **iovp);
+static int iov_add(struct iovec *iov, int n, const void *p, size_t len);
 
 /* You won't lose style points for including this long line in your code */
-static const char *user_agent_hdr =
-    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
-    "Firefox/10.0.3\r\n";
+#define USER_AGENT_HDR \
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 " \
+    "Firefox/10.0.3\r\n"
+
+/* upstream 요청에서 Host 값 뒤에 붙는 고정 헤더들. 요청마다 만들지 않고 이 블록을 그대로 가리킨다 */
+static const char fixed_hdrs[] =
+    "\r\n"
+    USER_AGENT_HDR
+    "Connection: keep-alive\r\n";
 
 int main(int argc, char **argv)
 {
-  int listenfd, connfd;
-  char hostname[MAXLINE], port[MAXLINE];
-  socklen_t clientlen;
-  struct sockaddr_storage clientaddr;
-  
+  int listenfd, i, n, timeout;
+  conn_t *c;
+  uint64_t now;
+  struct epoll_event ev, events[MAXEVENTS];
+  struct rlimit rl;
+
   if (argc != 2)
   {
     fprintf(stderr, "usage: %s <port>\n", argv[0]);
@@ -32,138 +178,1185 @@ int main(int argc, char **argv)
 
   // 클라가 먼저 끊어도 죽지 않게(SIGPIPE 무시)
   Signal(SIGPIPE, SIG_IGN);
+  // 연결마다 fd 를 하나(터널이면 셋) 쓰므로 허용되는 만큼 fd 한도를 올린다
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  pthread_attr_init(&thread_attr);
+  pthread_attr_setstacksize(&thread_attr, THREAD_STACK);
+  cache_init(MAX_CACHE_SIZE);
 
   listenfd = Open_listenfd(argv[1]);
+  if ((epfd = epoll_create1(0)) < 0)
+    unix_error("epoll_create1 error");
+  if ((wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+    unix_error("eventfd error");
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;  // NULL은 리스닝 소켓
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+    unix_error("epoll_ctl error");
+  ev.data.ptr = &wakefd;  // 워커가 연결을 돌려주거나 더 이른 타이머를 걸었다
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0)
+    unix_error("epoll_ctl error");
+  tw_init(&wheel, TICK_MS, tw_now_ms());
+
+  // 대기 시간은 타이밍 휠이 정한다. 이벤트를 먼저 처리하고 만료된 타이머를 몰아서 처리
   while (1)
   {
-    clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
+    pthread_mutex_lock(&wheel_mutex);
+    now = tw_now_ms();
+    timeout = tw_next_timeout(&wheel, now);
+    loop_wakeup = timeout < 0 ? UINT64_MAX : now + timeout;
+    pthread_mutex_unlock(&wheel_mutex);
+
+    n = epoll_wait(epfd, events, MAXEVENTS, timeout);
+    if (n < 0 && errno != EINTR)
+      unix_error("epoll_wait error");
+
+    pthread_mutex_lock(&wheel_mutex);
+    loop_wakeup = 0;
+    pthread_mutex_unlock(&wheel_mutex);
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_conn(listenfd);
+      else if (events[i].data.ptr == &wakefd)
+        conn_unpark();
+      else
+        conn_ready(events[i].data.ptr);
+    }
+    while ((c = dead) != NULL) {
+      dead = c->next;
+      conn_close(c);
+    }
+
+    pthread_mutex_lock(&wheel_mutex);
+    tw_advance(&wheel, tw_now_ms());
+    pthread_mutex_unlock(&wheel_mutex);
+  }
+}
+
+/* 휠에 타이머를 건다. 루프가 그보다 늦게 깨어날 예정이면 깨워서 대기 시간을 다시 정하게 한다 */
+static void wheel_add(tw_timer_t *t, unsigned timeout_ms)
+{
+  uint64_t when = tw_now_ms() + timeout_ms;
+  int wake;
+
+  pthread_mutex_lock(&wheel_mutex);
+  tw_add_at(&wheel, t, when);
+  wake = when < loop_wakeup;
+  pthread_mutex_unlock(&wheel_mutex);
+  if (wake)
+    eventfd_write(wakefd, 1);
+}
+
+/* 반환 후에는 핸들러가 돌고 있지 않음이 보장된다(핸들러도 wheel_mutex 안에서 돈다) */
+static void wheel_del(tw_timer_t *t)
+{
+  pthread_mutex_lock(&wheel_mutex);
+  tw_del(&wheel, t);
+  pthread_mutex_unlock(&wheel_mutex);
+}
 
-    doit(connfd);
+static void accept_conn(int listenfd)
+{
+  char hostname[MAXLINE], port[MAXLINE];
+  socklen_t clientlen;
+  struct sockaddr_storage clientaddr;
+  struct epoll_event ev;
+  conn_t *c;
+  int connfd, one = 1;
+
+  clientlen = sizeof(clientaddr);
+  if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
+    fprintf(stderr, "accept error: %s\n", strerror(errno));  // EMFILE 등은 죽지 않고 넘긴다
+    return;
+  }
+  // 역방향 DNS 조회로 루프를 막지 않도록 숫자 주소만 찍는다
+  Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+              NI_NUMERICHOST | NI_NUMERICSERV);
+  printf("Accepted connection from (%s, %s)\n", hostname, port);
+
+  // 헤더와 본문을 따로 쓰므로 Nagle 이 지연 ACK 를 기다리게 두지 않는다
+  setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  c = Malloc(sizeof(conn_t));
+  c->fd = connfd;
+  c->tunnel = NULL;
+  Rio_readinitb(&c->rio, connfd);
+  tw_timer_init(&c->idle, conn_timeout, c);
+  tw_timer_init(&c->io, io_timeout, c);
+  // ONESHOT: 연결 스레드가 맡은 동안에는 루프가 이벤트를 받지 않는다
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
     Close(connfd);
+    Free(c);
+    return;
   }
+  wheel_add(&c->idle, REQUEST_TIMEOUT_MS);
 }
 
-void doit(int fd)
+/* 요청이 도착했다. 연결을 루프에서 떼어 연결 스레드에 넘긴다 */
+static void conn_ready(conn_t *c)
 {
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char host_header[MAXLINE], other_header[MAXLINE];
-  char hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
-  char reqest_buf[MAXLINE];
-  rio_t rio;
+  pthread_t tid;
+
+  if (c->tunnel) {  // 터널은 스레드 없이 루프에서 옮긴다
+    tunnel_ready(c);
+    return;
+  }
+  wheel_del(&c->idle);
+  Pthread_create(&tid, &thread_attr, conn_thread, c);
+}
+
+/* 연결 스레드가 돌려준 연결들을 다시 epoll 에 걸고 다음 요청을 기다린다 */
+static void conn_unpark(void)
+{
+  struct epoll_event ev;
+  eventfd_t cnt;
+  conn_t *c, *next;
+
+  eventfd_read(wakefd, &cnt);
+  pthread_mutex_lock(&park_mutex);
+  c = parked;
+  parked = NULL;
+  pthread_mutex_unlock(&park_mutex);
+
+  for (; c; c = next) {
+    next = c->next;
+    if (c->tunnel) {
+      tunnel_start(c);
+      continue;
+    }
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+      conn_close(c);
+      continue;
+    }
+    wheel_add(&c->idle, KEEPALIVE_TIMEOUT_MS);
+  }
+}
+
+/* 연결(터널이면 upstream 과 파이프까지)을 닫고 해제한다 */
+static void conn_close(conn_t *c)
+{
+  if (c->tunnel) {
+    relay_half_close(&c->tunnel->up);
+    relay_half_close(&c->tunnel->down);
+    Close(c->tunnel->servefd);
+    Free(c->tunnel);
+  }
+  Close(c->fd);  // close가 epoll 등록도 해제한다
+  rio_freeb(&c->rio);
+  Free(c);
+}
+
+/* 제한 시간 안에 (다음) 요청을 보내지 않은 연결은 끊는다. 루프에 있는 연결에만 걸린다 */
+static void conn_timeout(tw_timer_t *t, void *arg)
+{
+  conn_t *c = arg;
+
+  printf("Idle timeout on fd %d\n", c->fd);
+  conn_close(c);
+}
 
-  Rio_readinitb(&rio, fd);
-  Rio_readlineb(&rio, buf, MAXLINE);
+/* 워커가 막혀 있는 소켓은 shutdown 으로 깨운다. 정리는 워커가 한다 */
+static void io_timeout(tw_timer_t *t, void *arg)
+{
+  conn_t *c = arg;
+
+  printf("Request timeout on fd %d\n", c->fd);
+  shutdown(c->fd, SHUT_RDWR);
+}
+
+static void upstream_timeout(tw_timer_t *t, void *arg)
+{
+  request_t *req = arg;
+
+  printf("Upstream timeout on fd %d\n", req->servefd);
+  shutdown(req->servefd, SHUT_RDWR);
+  if (req->clientfd >= 0)  // 본문을 보내다 멈춘 클라이언트도 깨운다
+    shutdown(req->clientfd, SHUT_RDWR);
+}
+
+/*
+ * 연결 스레드에서: CONNECT 응답까지 나간 연결을 터널로 만든다.
+ * 클라이언트가 응답을 기다리지 않고 보낸 바이트(TLS ClientHello 등)는 rio 버퍼에 있으니 먼저 넘긴다.
+ */
+static int tunnel_init(conn_t *c, int servefd)
+{
+  tunnel_t *t;
+
+  if (c->rio.rio_cnt > 0 && rio_writen(servefd, c->rio.rio_bufptr, c->rio.rio_cnt) < 0) {
+    Close(servefd);
+    return 0;
+  }
+  rio_freeb(&c->rio);  // 이제부터는 splice 로 옮기므로 rio 버퍼가 필요 없다
+  t = Malloc(sizeof(tunnel_t));
+  t->servefd = servefd;
+  t->closed = 0;
+  if (relay_half_init(&t->up, c->fd, servefd) < 0) {
+    Close(servefd);
+    Free(t);
+    return 0;
+  }
+  if (relay_half_init(&t->down, servefd, c->fd) < 0) {
+    relay_half_close(&t->up);
+    Close(servefd);
+    Free(t);
+    return 0;
+  }
+  c->tunnel = t;
+  return 1;
+}
+
+/*
+ * 루프에서: 터널의 두 소켓을 non-blocking 으로 바꿔 edge-triggered 로 등록한다.
+ * 어느 쪽 이벤트든 두 방향을 모두 펌프하므로 관심 이벤트를 다시 걸 필요가 없다.
+ */
+static void tunnel_start(conn_t *c)
+{
+  struct epoll_event ev;
+
+  fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+  fcntl(c->tunnel->servefd, F_SETFL, fcntl(c->tunnel->servefd, F_GETFL) | O_NONBLOCK);
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0 ||
+      epoll_ctl(epfd, EPOLL_CTL_ADD, c->tunnel->servefd, &ev) < 0) {
+    conn_close(c);
+    return;
+  }
+  wheel_add(&c->idle, TUNNEL_TIMEOUT_MS);
+}
+
+/* 루프에서: 터널 소켓 중 하나가 준비됐다. 양쪽이 모두 EOF 를 전했거나 오류면 닫는다 */
+static void tunnel_ready(conn_t *c)
+{
+  tunnel_t *t = c->tunnel;
+  ssize_t up, down;
+
+  if (t->closed)
+    return;
+  up = relay_half_pump(&t->up);
+  down = relay_half_pump(&t->down);
+  if (up < 0 || down < 0 || (relay_half_done(&t->up) && relay_half_done(&t->down))) {
+    wheel_del(&c->idle);
+    t->closed = 1;
+    c->next = dead;
+    dead = c;
+    return;
+  }
+  if (up > 0 || down > 0)
+    wheel_add(&c->idle, TUNNEL_TIMEOUT_MS);
+}
+
+/*
+ * 연결 스레드. 버퍼에 이미 다음 요청이 들어와 있으면(파이프라인) 지금 요청은
+ * 별도 스레드에 맡기고 계속 읽어 들여 동시에 처리한다. 응답은 응답 큐가
+ * 요청 순서대로 내보낸다. 모든 응답이 나간 뒤 연결을 루프로 돌려보내거나 닫는다.
+ */
+static void *conn_thread(void *vargp)
+{
+  conn_t *c = vargp;
+  request_t *req;
+  respq_t q;
+  pthread_t tid;
+  int ok, keep, tunnelfd = -1;
+
+  Pthread_detach(pthread_self());
+  respq_init(&q, c->fd);
+  while (1) {
+    req = request_new();
+    req->resp = respq_push(&q);  // 오류 응답도 순서를 지켜야 하므로 자리부터 잡는다
+    wheel_add(&c->io, REQUEST_TIMEOUT_MS);
+    ok = read_request(&c->rio, req);
+    wheel_del(&c->io);
+    if (!ok) {  // EOF 또는 오류 응답을 보냈다: 앞선 응답까지만 보내고 닫는다
+      resp_done(req->resp, 0);
+      request_free(req);
+      break;
+    }
+    if (!strcasecmp(req->method, "CONNECT")) {  // 이후의 바이트는 요청이 아니라 터널 데이터다
+      tunnelfd = doit_connect(req);
+      request_free(req);
+      break;
+    }
+    // 본문이 있는 요청은 본문을 다 읽어야 다음 요청이 보이므로 이 스레드에서 처리한다
+    if (req->keepalive && c->rio.rio_cnt > 0 && !req->bodylen && !req->chunked &&
+        respq_pending(&q) <= MAX_PIPELINE) {
+      Pthread_create(&tid, &thread_attr, request_thread, req);
+      continue;
+    }
+    req->rio = &c->rio;
+    keep = doit(req);
+    request_free(req);
+    if (!keep || c->rio.rio_cnt == 0)
+      break;
+  }
+
+  keep = respq_wait(&q);
+  respq_destroy(&q);
+  if (tunnelfd >= 0) {
+    if (keep)
+      keep = tunnel_init(c, tunnelfd);
+    else
+      Close(tunnelfd);
+  }
+  if (!keep) {
+    conn_close(c);
+    return NULL;
+  }
+  if (c->rio.rio_cnt == 0)  // 다음 요청이 올 때까지 버퍼를 들고 있지 않는다
+    rio_freeb(&c->rio);
+  pthread_mutex_lock(&park_mutex);
+  c->next = parked;
+  parked = c;
+  pthread_mutex_unlock(&park_mutex);
+  eventfd_write(wakefd, 1);
+  return NULL;
+}
+
+/* 파이프라인된 요청 하나를 처리한다 */
+static void *request_thread(void *vargp)
+{
+  request_t *req = vargp;
+
+  Pthread_detach(pthread_self());
+  doit(req);
+  request_free(req);
+  return NULL;
+}
+
+static request_t *request_new(void)
+{
+  request_t *req;
+
+  pthread_mutex_lock(&spare_mutex);
+  if ((req = spare_reqs) != NULL) {
+    spare_reqs = req->next;
+    spare_count--;
+  }
+  pthread_mutex_unlock(&spare_mutex);
+  if (req == NULL) {
+    req = Malloc(sizeof(request_t));
+    arena_init(&req->arena, req->arena_buf, sizeof(req->arena_buf));
+  }
+  return req;
+}
+
+/* 아레나를 되감고 재사용 목록에 돌려준다. 목록이 차 있으면 해제한다 */
+static void request_free(request_t *req)
+{
+  arena_reset(&req->arena);
+  pthread_mutex_lock(&spare_mutex);
+  if (spare_count < REQ_POOL_MAX) {
+    req->next = spare_reqs;
+    spare_reqs = req;
+    spare_count++;
+    req = NULL;
+  }
+  pthread_mutex_unlock(&spare_mutex);
+  if (req) {
+    arena_free(&req->arena);
+    Free(req);
+  }
+}
+
+/*
+ * 요청 줄과 헤더를 읽어 req 를 채운다. 처리할 요청이면 1,
+ * 클라이언트가 닫았거나 오류 응답을 보내 연결을 끝내야 하면 0
+ */
+int read_request(rio_t *rio, request_t *req)
+{
+  char *old;
+  int rc;
+
+  // rio 버퍼 위에서 바로 파싱하고, 헤드가 다 오지 않았으면 버퍼를 더 채운다
+  hp_init(&req->hp, HP_MAX_HEAD);
+  while ((rc = hp_parse(&req->hp, rio->rio_bufptr, rio->rio_cnt)) == HP_AGAIN) {
+    old = rio->rio_bufptr;
+    if (rio_fillb(rio) <= 0)
+      return 0;  // 클라이언트가 연결을 닫았다
+    hp_rebase(&req->hp, old, rio->rio_bufptr);
+  }
+  if (rc == HP_TOOBIG) {
+    clienterror(req->resp, "request", "431", "Request Header Fields Too Large", "Proxy limits the request head size");
+    return 0;
+  }
+  if (rc != HP_DONE) {
+    clienterror(req->resp, "request", "400", "Bad request", "Proxy could not parse the request");
+    return 0;
+  }
+
+  // 다음 요청이 같은 버퍼로 들어오므로 헤드만 떼어 요청에 붙인다 (요청당 memcpy 한 번)
+  if ((req->head = arena_alloc(&req->arena, req->hp.headlen)) == NULL) {
+    clienterror(req->resp, "request", "503", "Service Unavailable", "Proxy is out of memory");
+    return 0;
+  }
+  memcpy(req->head, rio->rio_bufptr, req->hp.headlen);
+  hp_rebase(&req->hp, rio->rio_bufptr, req->head);
+  rio_consumeb(rio, req->hp.headlen);
+  hp_terminate(&req->hp);
+  req->method = (char *)req->hp.method.p;
+  req->uri = (char *)req->hp.uri.p;
   printf("Request headers:\n");
-  printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version);
-  if (strcasecmp(method, "GET") != 0) {
-    clienterror(fd, method, "501", "Not implemented", "This Server does not implement this method");
+  printf("%s %s %s\n", req->method, req->uri, req->hp.version.p);
+
+  // HTTP/1.1은 기본이 지속 연결, 1.0은 keep-alive를 요청했을 때만
+  req->http11 = req->hp.minor >= 1;
+  req->keepalive = req->http11;
+  req->rio = NULL;
+  req->clientfd = -1;
+  if (read_requesthdrs(req) < 0) {  // 본문 경계를 모르면 뒤따르는 바이트를 요청으로 읽게 된다
+    clienterror(req->resp, "request", "400", "Bad request", "Proxy could not determine the request body length");
+    return 0;
+  }
+  return 1;
+}
+
+/* 요청 1건을 origin 에 보내고 응답을 전달한다. 연결을 유지해도 되면 1, 닫아야 하면 0 */
+int doit(request_t *req)
+{
+  char *hostname, *port;
+  const char *path;
+  struct iovec *reqest_iov;
+  int keepalive = req->keepalive, iovcnt, rc = 0;
+  int hasbody = req->bodylen > 0 || req->chunked;
+
+  if (!hasbody && !strcasecmp(req->method, "GET")) {
+    switch (serve_cached(req)) {
+    case 1:
+      resp_done(req->resp, keepalive);
+      return keepalive;
+    case -1:
+      resp_done(req->resp, 0);
+      return 0;
+    }
+  }
+  // 본문을 보내지 못하면 남은 본문과 다음 요청의 경계를 알 수 없으니 연결을 닫는다
+  if (parse_uri(&req->arena, req->uri, &hostname, &port, &path) < 0) {
+    clienterror(req->resp, req->uri, "503", "Service Unavailable", "Proxy is out of memory");
+    keepalive = keepalive && !hasbody;
+    resp_done(req->resp, keepalive);
+    return keepalive;
+  }
+  if ((req->servefd = upstream_get(hostname, port)) < 0) {
+    clienterror(req->resp, hostname, "502", "Bad gateway", "Proxy could not connect to the server");
+    keepalive = keepalive && !hasbody;
+    resp_done(req->resp, keepalive);
+    return keepalive;
+  }
+  tw_timer_init(&req->timer, upstream_timeout, req);
+  wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+  req->reuse = 0;
+  iovcnt = reassemble(req, path, hostname, &reqest_iov);
+  if (iovcnt < 0 || rio_writev(req->servefd, reqest_iov, iovcnt) < 0 ||
+      (hasbody && (rc = send_body(req)) < 0)) {
+    // 청크 틀이 틀렸으면 본문 끝을 알 수 없다. 클라이언트 잘못이니 400, upstream 연결과 함께 닫는다
+    if (rc == -2)
+      clienterror(req->resp, "request", "400", "Bad request", "Proxy could not parse the chunked request body");
+    else
+      clienterror(req->resp, hostname, "502", "Bad gateway", "Proxy could not send the request");
+    keepalive = 0;
+  }
+  else
+    keepalive = forward_response(req);
+  wheel_del(&req->timer);  // 타이머가 닫힌 fd 를 shutdown 하지 않도록 먼저 뗀다
+  if (req->reuse)
+    upstream_put(hostname, port, req->servefd);
+  else
+    Close(req->servefd);
+  resp_done(req->resp, keepalive);
+  return keepalive;
+}
+
+/*
+ * 캐시에 있는 응답을 origin 에 가지 않고 보낸다. 락은 참조를 잡는 동안만 쥐고,
+ * 보내는 동안에는 캐시 청크를 복사 없이 writev 한다. 그 사이 항목이 쫓겨나도
+ * 우리가 잡은 참조가 청크를 살려 둔다. 보냈으면 1, 없으면 0, 클라이언트에 쓰지 못했으면 -1
+ */
+static int serve_cached(request_t *req)
+{
+  bufchain_t *head, *body;
+  const bc_chunk_t *pos;
+  struct iovec iov[CACHE_IOV];
+  char *conn = req->keepalive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  int n, rc = 1;
+
+  if (!cache_lookup(req->uri, &head, &body))
+    return 0;
+  pos = head->head;
+  n = bc_iov(&pos, iov, CACHE_IOV - 1);  // 헤드는 보통 청크 하나: 본문과 같은 writev 에 싣는다
+  if (pos != NULL) {
+    rc = write_chain(req->resp, iov, n, pos) < 0 ? -1 : 1;
+    n = 0;
+  }
+  iov[n].iov_base = conn;
+  iov[n].iov_len = strlen(conn);
+  if (rc > 0 && write_chain(req->resp, iov, n + 1, body->head) < 0)
+    rc = -1;
+  bc_unref(head);
+  bc_unref(body);
+  return rc;
+}
+
+/* 풀에서 host:port 로 열린 연결을 꺼낸다. 없으면 새로 연결한다 */
+static int upstream_get(char *hostname, char *port)
+{
+  char key[MAXLINE], c;
+  upstream_t **pp, *u, *found;
+  uint64_t now = tw_now_ms();
+  int fd, one = 1;
+
+  snprintf(key, sizeof(key), "%s:%s", hostname, port);
+  while (1) {
+    found = NULL;
+    pthread_mutex_lock(&pool_mutex);
+    for (pp = &pool; (u = *pp) != NULL; ) {
+      if (now - u->since > POOL_IDLE_MS) {  // 오래 놀았다: origin 이 이미 닫았을 것이다
+        *pp = u->next;
+        pool_count--;
+        Close(u->fd);
+        Free(u);
+        continue;
+      }
+      if (!found && !strcmp(u->key, key)) {
+        found = u;
+        *pp = u->next;
+        pool_count--;
+        continue;
+      }
+      pp = &u->next;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    if (!found) {
+      if ((fd = open_clientfd(hostname, port)) >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      return fd;
+    }
+
+    // 놀던 사이 origin 이 닫았거나 뭔가를 보냈다면 쓸 수 없다
+    fd = found->fd;
+    Free(found);
+    if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN)
+      return fd;
+    Close(fd);
+  }
+}
+
+/* 응답을 끝까지 읽은 upstream 연결을 풀에 넣는다. 풀이 차 있으면 닫는다 */
+static void upstream_put(char *hostname, char *port, int fd)
+{
+  upstream_t *u;
+
+  pthread_mutex_lock(&pool_mutex);
+  if (pool_count >= POOL_MAX) {
+    pthread_mutex_unlock(&pool_mutex);
+    Close(fd);
     return;
   }
-  read_requesthdrs(&rio, host_header, other_header);
-  parse_uri(uri, hostname, port, path);
-  int servefd = Open_clientfd(hostname, port);
-  reassemble(reqest_buf, path, hostname, other_header);
-  Rio_writen(servefd, reqest_buf, strlen(reqest_buf));
-  forward_response(servefd, fd);
+  u = Malloc(sizeof(upstream_t));
+  snprintf(u->key, sizeof(u->key), "%s:%s", hostname, port);
+  u->fd = fd;
+  u->since = tw_now_ms();
+  u->next = pool;
+  pool = u;
+  pool_count++;
+  pthread_mutex_unlock(&pool_mutex);
 }
 
-void reassemble(char *req, char *path, char *hostname, char *other_header)
+/*
+ * CONNECT host:port. upstream 에 연결하고 200 을 보낸다. 연결된 fd, 실패면 -1.
+ * 터널 자체는 앞선 응답이 모두 나간 뒤 이벤트 루프가 맡는다.
+ */
+int doit_connect(request_t *req)
 {
-  sprintf(req,
-    "GET %s HTTP/1.0\r\n"
-    "Host: %s\r\n"
-    "%s"
-    "Connection: close\r\n"
-    "Proxy-Connection: close\r\n"
-    "%s"
-    "\r\n",
-    path,
-    hostname,
-    user_agent_hdr,
-    other_header
-  );
+  char *hostname, *port;
+  const char *path;
+  static const char *established = "HTTP/1.1 200 Connection Established\r\n\r\n";
+  int servefd;
+
+  if (parse_uri(&req->arena, req->uri, &hostname, &port, &path) < 0 ||
+      (servefd = open_clientfd(hostname, port)) < 0) {
+    clienterror(req->resp, req->uri, "502", "Bad gateway", "Proxy could not connect to the server");
+    resp_done(req->resp, 0);
+    return -1;
+  }
+  resp_write(req->resp, established, strlen(established));
+  resp_done(req->resp, 1);
+  return servefd;
 }
 
-void forward_response(int servefd, int fd)
+/*
+ * 요청 본문을 클라이언트에서 upstream 으로 흘려보낸다. 모아 두지 않으므로
+ * 본문이 아무리 커도 메모리는 rio 버퍼와 relay 파이프뿐이다.
+ * chunked 본문은 틀까지 그대로 넘기되, 응답과 같은 코덱으로 본문의 끝을 찾는다.
+ * 코덱은 16진수 자릿수만, 정해진 자릿수까지 받고 CRLF 를 확인하므로 origin 과 끝을 다르게 볼 수 없다.
+ * 성공하면 0, 보내거나 받다 실패하면 -1, 청크 틀이 틀렸으면 -2 (틀린 줄은 upstream 에 보내지 않는다)
+ */
+static int send_body(request_t *req)
+{
+  static const char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
+  rio_t *rp = req->rio;
+  chunked_t d;
+  const char *data;
+  size_t used, datalen, seg;
+  int rc = -1;
+
+  // 클라이언트가 100 을 기다리고 있다면 보내 준다 (앞선 응답이 다 나간 뒤에 도착한다)
+  if (req->expect && resp_write(req->resp, cont, strlen(cont)) < 0)
+    return -1;
+  req->clientfd = req->rio->rio_fd;
+  if (!req->chunked) {
+    rc = body_relay(req, req->bodylen);
+    goto done;
+  }
+  // 크기 줄, CRLF, trailer 는 rio 버퍼 안에서 코덱에 통과시키며 넘기고, 청크 데이터는 body_relay 로
+  chunked_init(&d);
+  while (chunked_done(&d) == 0) {
+    if (rp->rio_cnt > 0) {
+      used = chunked_decode(&d, rp->rio_bufptr, rp->rio_cnt, &data, &datalen);
+      if (chunked_done(&d) < 0) {
+        rc = -2;
+        goto done;
+      }
+      if (rio_writen(req->servefd, rp->rio_bufptr, used) < 0)
+        goto done;
+      rio_consumeb(rp, used);
+      continue;
+    }
+    wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+    if (d.state == CH_DATA) {
+      seg = d.remaining < RELAY_SEGMENT ? d.remaining : RELAY_SEGMENT;
+      if (body_relay(req, seg) < 0)
+        goto done;
+      chunked_skip(&d, seg);
+    }
+    else if (rio_fillb(rp) <= 0)
+      goto done;
+  }
+  rc = 0;
+done:
+  wheel_del(&req->timer);  // 핸들러가 clientfd 를 보지 않게 한 뒤 지운다
+  req->clientfd = -1;
+  wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+  return rc;
+}
+
+/* 클라이언트 본문 len 바이트를 upstream 으로. rio 버퍼에 남은 것부터 보내고 나머지는 splice */
+static int body_relay(request_t *req, size_t len)
+{
+  rio_t *rp = req->rio;
+  size_t n = rp->rio_cnt < len ? rp->rio_cnt : len, seg;
+
+  if (n > 0) {
+    if (rio_writen(req->servefd, rp->rio_bufptr, n) < 0)
+      return -1;
+    rio_consumeb(rp, n);
+    len -= n;
+  }
+  while (len > 0) {
+    seg = len < RELAY_SEGMENT ? len : RELAY_SEGMENT;
+    wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+    if (relay_splice(rp->rio_fd, req->servefd, seg) != (ssize_t)seg)
+      return -1;
+    len -= seg;
+  }
+  return 0;
+}
+
+/* iov[n] 을 p[0..len) 로 채우고 다음 자리를 돌려준다 */
+static int iov_add(struct iovec *iov, int n, const void *p, size_t len)
+{
+  iov[n].iov_base = (void *)p;
+  iov[n].iov_len = len;
+  return n + 1;
+}
+
+/*
+ * upstream 요청 헤드를 iovec 목록으로 만든다. HTTP/1.1 로 보내고 연결을 유지해 다음 요청에 다시 쓴다.
+ * 요청 줄 조각과 살린 클라이언트 헤더는 요청 헤드 사본 안의 뷰를, 고정 헤더는 정적 블록을
+ * 가리킬 뿐 바이트를 복사하지 않는다. 홉 단위 헤더와 프록시가 바꿔 끼우는 헤더는 빠진다.
+ * 목록은 요청 아레나에 만들어 *iovp 에 두고 길이를 반환한다. 메모리가 모자라면 -1
+ */
+int reassemble(request_t *req, const char *path, const char *hostname, struct iovec **iovp)
+{
+  static const char *skip[] = {
+    "Host", "Connection", "Proxy-Connection", "Keep-Alive", "User-Agent", "Expect", NULL
+  };
+  static const char host_prefix[] = " HTTP/1.1\r\nHost: ";
+  struct iovec *iov;
+  hp_header_t *h;
+  int i, j, n = 0;
+
+  // 요청 줄, Host, 고정 헤더 블록에 6개 + 헤더마다 4개(이름, ": ", 값, CRLF) + 끝의 빈 줄
+  if ((iov = arena_alloc(&req->arena, (7 + 4 * req->hp.nheaders) * sizeof(*iov))) == NULL)
+    return -1;
+  n = iov_add(iov, n, req->method, req->hp.method.len);
+  n = iov_add(iov, n, " ", 1);
+  n = iov_add(iov, n, path, strlen(path));
+  n = iov_add(iov, n, host_prefix, sizeof(host_prefix) - 1);
+  n = iov_add(iov, n, hostname, strlen(hostname));
+  n = iov_add(iov, n, fixed_hdrs, sizeof(fixed_hdrs) - 1);
+  for (i = 0; i < req->hp.nheaders; i++) {
+    h = &req->hp.headers[i];
+    for (j = 0; skip[j] && !hp_streq(h->name, skip[j]); j++)
+      ;
+    if (skip[j])
+      continue;
+    n = iov_add(iov, n, h->name.p, h->name.len);
+    n = iov_add(iov, n, ": ", 2);
+    n = iov_add(iov, n, h->value.p, h->value.len);
+    n = iov_add(iov, n, "\r\n", 2);
+  }
+  n = iov_add(iov, n, "\r\n", 2);
+  *iovp = iov;
+  return n;
+}
+
+/*
+ * origin 응답을 클라이언트로 전달한다.
+ * 상태 줄과 헤더는 한 번만 읽어 파싱하고 한 번에 쓴 뒤, 본문은 줄 단위가 아니라
+ * Content-Length 만큼 큰 덩어리로 옮긴다. 바이너리 본문도 그대로 통과한다.
+ * chunked 본문은 코덱으로 끝을 찾아 HTTP/1.1 클라이언트에는 그대로, 1.0 클라이언트에는
+ * 풀어서 보낸다. EOF 로 끝나는 본문은 1.1 클라이언트에 청크로 싸서 보낸다.
+ * origin 쪽 홉 단위 헤더는 버리고, 클라이언트가 응답 끝을 알 수 있을 때만 연결을 유지한다.
+ * Content-Length 는 프록시가 본문을 그 길이대로 옮길 때만 다시 붙인다. 청크를 풀거나 싸서
+ * 틀을 바꾸면 빼서, 클라이언트가 본문 끝을 origin 의 틀로 잘못 보지 않게 한다.
+ * 캐시는 URI 로만 찾는 공유 캐시라서 Vary 나 Set-Cookie 가 있는 응답, 그리고
+ * Authorization/Cookie 를 보낸 요청의 응답은 public/s-maxage 가 없으면 넣지 않는다.
+ * 본문을 정확히 끝까지 읽었고 origin 도 연결을 유지하면 req->reuse 를 켠다.
+ * 클라이언트 연결을 유지해도 되면 1을 반환한다.
+ */
+static int relay_response(request_t *req, rio_t *rp)
+{
+  resp_t *r = req->resp;
+  char head[MAXBUF], *line;
+  struct iovec iov[CACHE_IOV];
+  size_t headlen, bodylen, clen, n, cachelen;
+  ssize_t rc;
+  int major, minor, status, first, keepalive = req->keepalive;
+  int chunked, origin_keep, encode, nostore, shared;
+  bufchain_t *hc, *bc;
+  int http11 = req->http11;  // 클라이언트가 chunked 를 받을 수 있다
+
+  req->reuse = 0;
+again:
+  headlen = 0;
+  bodylen = RELAY_EOF;
+  clen = RELAY_EOF;
+  status = 0;
+  first = 1;
+  chunked = 0;
+  origin_keep = 0;
+  nostore = 0;
+  shared = 0;
+  // 끝에 붙일 헤더 자리(HEAD_RESERVE)는 남겨 두고 읽는다
+  while ((rc = rio_readlineb(rp, head + headlen, sizeof(head) - headlen - HEAD_RESERVE)) > 0) {
+    line = head + headlen;
+    if (first) {
+      if (sscanf(line, "HTTP/%d.%d %d", &major, &minor, &status) == 3)
+        origin_keep = major == 1 && minor >= 1;
+    }
+    else if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+      break;  // 헤더 끝. 빈 줄은 아래에서 다시 붙인다
+    else if (!strncasecmp(line, "Content-Length:", 15)) {
+      clen = strtoull(line + 15, NULL, 10);
+      continue;  // 틀을 정한 뒤 아래에서 다시 붙인다
+    }
+    else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+      chunked = has_token(line + 18, "chunked");
+      if (chunked && !http11)
+        continue;  // 1.0 클라이언트에는 풀어서 보낸다
+    }
+    else if (!strncasecmp(line, "Connection:", 11)) {
+      if (has_token(line + 11, "close"))
+        origin_keep = 0;
+      continue;  // 홉 단위 헤더는 덮어쓴다
+    }
+    else if (!strncasecmp(line, "Proxy-Connection:", 17) || !strncasecmp(line, "Keep-Alive:", 11))
+      continue;
+    else if (!strncasecmp(line, "Cache-Control:", 14)) {
+      nostore |= has_token(line + 14, "no-store") || has_token(line + 14, "private");
+      shared |= has_token(line + 14, "public") || has_token(line + 14, "s-maxage");
+    }
+    else if (!strncasecmp(line, "Vary:", 5) || !strncasecmp(line, "Set-Cookie:", 11))
+      nostore = 1;  // 키가 URI 뿐이라 요청마다 달라지거나 쿠키를 심는 응답은 나눠 줄 수 없다
+    first = 0;
+    headlen += rc;
+    if (headlen + 2 * HEAD_RESERVE >= sizeof(head)) {  // 버퍼보다 큰 헤더는 모인 만큼 먼저 내보낸다
+      if (resp_write(r, head, headlen) < 0)
+        return 0;
+      headlen = 0;
+      nostore = 1;  // 헤드를 다 갖고 있지 않으니 캐시에 넣을 수 없다
+    }
+  }
+  if (rc <= 0) {  // 헤더 도중 EOF: 받은 만큼만 넘기고 닫는다
+    if (headlen > 0)
+      resp_write(r, head, headlen);
+    return 0;
+  }
+  if (status >= 100 && status < 200 && status != 101)
+    goto again;  // 중간 응답(100 Continue 등)은 버리고 최종 응답을 읽는다
+  if (req->private && !shared)
+    nostore = 1;  // 인증된 요청의 응답은 public 이나 s-maxage 가 있어야 공유한다 (RFC 7234 3.2)
+
+  // 본문이 없는 응답이거나, 클라이언트가 응답 끝을 알 수 있어야 연결을 유지한다
+  encode = 0;
+  if (chunked)  // Transfer-Encoding 이 있으면 Content-Length 는 무시하고 뺀다 (RFC 7230 3.3.3)
+    clen = RELAY_EOF;
+  bodylen = clen;
+  if (status == 101)  // 프로토콜 전환은 지원하지 않는다: 헤더만 넘기고 닫는다
+    keepalive = origin_keep = 0;
+  if (status == 101 || status == 204 || status == 304 || !strcasecmp(req->method, "HEAD")) {
+    bodylen = 0;
+    chunked = 0;
+  }
+  else if (chunked)
+    keepalive = keepalive && http11;
+  else if (bodylen == RELAY_EOF) {
+    encode = http11;
+    keepalive = keepalive && encode;
+    origin_keep = 0;
+  }
+  head[headlen] = '\0';
+  if (clen != RELAY_EOF)  // 본문을 이 길이대로 옮긴다. HEAD, 304 에도 원래 길이를 알린다
+    headlen += sprintf(head + headlen, "Content-Length: %zu\r\n", clen);
+  cachelen = headlen;
+  if (encode)
+    strcat(head + headlen, "Transfer-Encoding: chunked\r\n");
+  strcat(head + headlen, keepalive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+  headlen += strlen(head + headlen);
+
+  // 캐시할 만한 응답(GET 200, 길이를 아는 작은 본문)은 본문을 청크 사슬에 다 받은 뒤
+  // 그 청크에서 바로 보내고, 같은 사슬을 캐시에 넣는다
+  hc = bc = NULL;
+  if (status == 200 && !nostore && !chunked && bodylen <= MAX_OBJECT_SIZE &&
+      !strcasecmp(req->method, "GET") && req->bodylen == 0 && !req->chunked &&
+      (hc = bc_new()) != NULL && bc_append(hc, head, cachelen) == 0 && (bc = bc_new()) != NULL) {
+    if (read_chain(rp, bc, bodylen) < 0) {
+      bc_unref(hc);
+      bc_unref(bc);
+      clienterror(r, req->uri, "502", "Bad gateway", "Proxy could not read the response");
+      return 0;
+    }
+    iov[0].iov_base = head;
+    iov[0].iov_len = headlen;
+    rc = write_chain(r, iov, 1, bc->head);
+    cache_insert(req->uri, hc, bc);
+    bc_unref(hc);
+    bc_unref(bc);
+    if (rc < 0)
+      return 0;
+    req->reuse = origin_keep && rp->rio_cnt == 0;
+    return keepalive;
+  }
+  bc_unref(hc);
+
+  // 헤더를 읽으며 rio 버퍼에 같이 들어온 본문 앞부분은 헤더와 함께 writev 한 번으로 보낸다
+  n = 0;
+  if (!chunked && !encode)
+    n = (size_t)rp->rio_cnt < bodylen ? (size_t)rp->rio_cnt : bodylen;
+  iov[0].iov_base = head;
+  iov[0].iov_len = headlen;
+  iov[1].iov_base = rp->rio_bufptr;
+  iov[1].iov_len = n;
+  if (resp_writev(r, iov, 2) < 0)
+    return 0;
+  rio_consumeb(rp, n);
+
+  if (chunked) {
+    if (relay_chunked(req, rp, http11) < 0)
+      return 0;
+    req->reuse = origin_keep && rp->rio_cnt == 0;
+    return keepalive;
+  }
+  if (bodylen == RELAY_EOF) {  // 길이를 모르면 EOF까지 옮긴다
+    if (encode)
+      return relay_rechunk(req, rp) < 0 ? 0 : keepalive;
+    relay_body(req, RELAY_EOF);
+    return 0;
+  }
+
+  bodylen -= n;
+  if (bodylen > 0 && relay_body(req, bodylen) != bodylen)
+    return 0;  // origin이 약속한 길이보다 일찍 끊었다
+  req->reuse = origin_keep && rp->rio_cnt == 0;  // 응답 뒤에 군더더기가 없어야 재사용
+  return keepalive;
+}
+
+/* rp 에서 본문 len 바이트를 사슬에 받는다. 다 받았으면 0, origin 이 먼저 끊었거나 메모리가 모자라면 -1 */
+static int read_chain(rio_t *rp, bufchain_t *b, size_t len)
+{
+  char *p;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = rio_peekb(rp, &p)) <= 0)
+      return -1;
+    if ((size_t)n > len)
+      n = len;
+    if (bc_append(b, p, n) < 0)
+      return -1;
+    rio_consumeb(rp, n);
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * iov[0..n) 에 이어 청크 c 부터 사슬 끝까지를 보낸다. iov 는 CACHE_IOV 개짜리이고 n 은 그보다 작아야 한다.
+ * 청크가 한 번에 다 실리지 않으면 CACHE_IOV 개씩 나눠 writev 한다. 큰 본문은 청크를 복사하지 않고
+ * (MSG_ZEROCOPY) 보내고, 커널이 청크를 다 놓은 뒤에 돌아온다: 호출자는 그다음에 참조를 놓는다.
+ * 0, 클라이언트에 쓰지 못했으면 -1
+ */
+static int write_chain(resp_t *r, struct iovec *iov, int n, const bc_chunk_t *c)
+{
+  int rc = 0;
+
+  do {
+    n += bc_iov(&c, iov + n, CACHE_IOV - n);
+    if ((rc = resp_writev_zc(r, iov, n)) < 0)
+      break;
+    n = 0;
+  } while (c != NULL);
+  if (resp_zc_wait(r) < 0)  // 실패했어도 이미 넘긴 청크는 커널이 놓을 때까지 살려 둔다
+    rc = -1;
+  return rc;
+}
+
+/* origin 응답을 읽을 rio 를 만들어 relay_response 에 넘기고, 끝나면 버퍼를 돌려준다 */
+int forward_response(request_t *req)
 {
   rio_t serve_rio;
-  char response_buf[MAXLINE];
+  int keep;
+
+  Rio_readinitb(&serve_rio, req->servefd);
+  keep = relay_response(req, &serve_rio);
+  rio_freeb(&serve_rio);
+  return keep;
+}
+
+/*
+ * chunked 본문을 끝까지 옮긴다. raw 면 틀(크기 줄, CRLF, trailer)까지 그대로, 아니면 데이터만.
+ * 틀은 rio 버퍼 위에서 코덱으로 읽고, 버퍼가 빈 채 청크 데이터 안에 있으면
+ * 남은 길이만큼 splice 한다. 본문 끝까지 옮겼으면 0, 아니면 -1
+ */
+static int relay_chunked(request_t *req, rio_t *rp, int raw)
+{
+  chunked_t d;
+  const char *data;
+  size_t used, datalen, seg;
+
+  chunked_init(&d);
+  while (chunked_done(&d) == 0) {
+    if (rp->rio_cnt > 0) {
+      used = chunked_decode(&d, rp->rio_bufptr, rp->rio_cnt, &data, &datalen);
+      if (raw && resp_write(req->resp, rp->rio_bufptr, used) < 0)
+        return -1;
+      if (!raw && datalen > 0 && resp_write(req->resp, data, datalen) < 0)
+        return -1;
+      rio_consumeb(rp, used);
+      continue;
+    }
+    wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+    if (d.state == CH_DATA) {
+      seg = d.remaining < RELAY_SEGMENT ? d.remaining : RELAY_SEGMENT;
+      if (resp_relay(req->resp, rp->rio_fd, seg) != (ssize_t)seg)
+        return -1;
+      chunked_skip(&d, seg);
+    }
+    else if (rio_fillb(rp) <= 0)
+      return -1;
+  }
+  return chunked_done(&d) < 0 ? -1 : 0;
+}
 
-  Rio_readinitb(&serve_rio, servefd);
+/* EOF 로 끝나는 본문을 청크로 싸서 보낸다. 그래서 HTTP/1.1 클라이언트와의 연결을 유지할 수 있다 */
+static int relay_rechunk(request_t *req, rio_t *rp)
+{
+  char hdr[CHUNKED_HEAD_MAX], *p;
+  struct iovec iov[3];
   ssize_t n;
-  while ((n = Rio_readlineb(&serve_rio, response_buf, MAXLINE)) > 0) {
-    Rio_writen(fd, response_buf, n);
+
+  while (1) {
+    if (rp->rio_cnt == 0)
+      wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+    if ((n = rio_peekb(rp, &p)) < 0)
+      return -1;
+    if (n == 0)
+      break;
+    iov[0].iov_base = hdr;  // 청크 머리, 데이터, CRLF 를 한 번에
+    iov[0].iov_len = chunked_head(hdr, n);
+    iov[1].iov_base = p;
+    iov[1].iov_len = n;
+    iov[2].iov_base = "\r\n";
+    iov[2].iov_len = 2;
+    if (resp_writev(req->resp, iov, 3) < 0)
+      return -1;
+    rio_consumeb(rp, n);
   }
+  return resp_write(req->resp, CHUNKED_LAST, strlen(CHUNKED_LAST));
 }
 
-void read_requesthdrs(rio_t *rp, char *host_header, char *other_header)
+/*
+ * 본문을 RELAY_SEGMENT 씩 응답 큐로 옮기며 그때마다 upstream 타이머를 다시 건다.
+ * 큰 본문도 origin 이 계속 보내는 동안은 끊기지 않는다. 옮긴 바이트 수, 오류면 -1
+ */
+static ssize_t relay_body(request_t *req, size_t len)
 {
-  char buf[MAXLINE];
-  host_header[0] = '\0';
-  other_header[0] = '\0'; 
+  size_t left = len, seg;
+  ssize_t n, moved = 0;
+
+  while (left > 0) {
+    seg = left < RELAY_SEGMENT ? left : RELAY_SEGMENT;
+    wheel_add(&req->timer, UPSTREAM_TIMEOUT_MS);
+    if ((n = resp_relay(req->resp, req->servefd, seg)) < 0)
+      return -1;
+    moved += n;
+    if ((size_t)n < seg)
+      break;  // EOF
+    if (left != RELAY_EOF)
+      left -= n;
+  }
+  return moved;
+}
 
-  while(Rio_readlineb(rp, buf, MAXLINE) > 0 && strcmp(buf, "\r\n")) {
-    if (!strncasecmp(buf, "Host:", 5)) {
-      strcpy(host_header, buf);
+/*
+ * 파싱된 요청 헤더에서 연결 유지와 본문 길이를 정한다.
+ * Connection / Proxy-Connection 은 upstream에 넘기지 않고 keep-alive 판단에만 쓴다.
+ * 본문 길이(Content-Length, chunked)는 헤더를 그대로 넘기면서 값만 기억해 둔다.
+ * 프록시와 origin 이 본문 끝을 다르게 볼 수 있는 요청(Content-Length 와 Transfer-Encoding 이
+ * 같이 있거나, Content-Length 가 여러 개이거나 숫자가 아니거나, chunked 가 아닌 전송 코딩)은 -1
+ */
+int read_requesthdrs(request_t *req)
+{
+  hp_header_t *h;
+  int i, has_cl = 0, has_te = 0;
+
+  req->bodylen = 0;
+  req->chunked = 0;
+  req->expect = 0;
+  req->private = 0;
+  for (i = 0; i < req->hp.nheaders; i++) {
+    h = &req->hp.headers[i];
+    if (hp_streq(h->name, "Connection") || hp_streq(h->name, "Proxy-Connection")) {
+      if (has_token(h->value.p, "close"))
+        req->keepalive = 0;
+      else if (has_token(h->value.p, "keep-alive"))
+        req->keepalive = 1;
     }
-    else if (!strncasecmp(buf, "User-Agent:", 11) || !strncasecmp(buf, "Connection:", 11) || !strncasecmp(buf, "Proxy-Connection:", 17)) {
-      continue;  // 무시
+    else if (hp_streq(h->name, "Expect"))
+      req->expect = has_token(h->value.p, "100-continue");  // 100 은 프록시가 직접 답한다
+    else if (hp_streq(h->name, "Content-Length")) {
+      if (has_cl++ || parse_length(h->value, &req->bodylen) < 0)
+        return -1;
     }
-    else {
-      strcat(other_header, buf);
+    else if (hp_streq(h->name, "Transfer-Encoding")) {
+      has_te = 1;
+      req->chunked = has_token(h->value.p, "chunked");
     }
+    else if (hp_streq(h->name, "Authorization") || hp_streq(h->name, "Cookie"))
+      req->private = 1;  // 이 클라이언트만의 응답일 수 있다
+  }
+  if (has_te && (has_cl || !req->chunked))
+    return -1;
+  return 0;
+}
+
+/* Content-Length 값을 읽는다. 숫자만으로 된 값이 아니거나 너무 크면 -1 */
+static int parse_length(hp_str_t v, size_t *lenp)
+{
+  size_t i, len = 0;
+
+  if (v.len == 0)
+    return -1;
+  for (i = 0; i < v.len; i++) {
+    if (!isdigit((unsigned char)v.p[i]) || len > (SIZE_MAX - 9) / 10)
+      return -1;
+    len = len * 10 + (v.p[i] - '0');
   }
+  *lenp = len;
+  return 0;
 }
 
-void parse_uri(char *uri, char *hostname, char *port, char *path)
+/* 콤마로 구분된 헤더 값 목록에 token이 있는지 (대소문자 무시, s-maxage=60 같은 인자는 건너뛴다) */
+static int has_token(const char *value, const char *token)
 {
-  char *hostbegin, *hostend, *portbegin, *pathbegin;
-  char buf[MAXLINE];
- 
-  strcpy(buf, uri);
- 
-  hostbegin = strstr(buf, "//");
-  hostbegin = (hostbegin != NULL) ? hostbegin + 2 : buf; 
- 
+  size_t len = strlen(token);
+
+  while (*value) {
+    while (*value == ' ' || *value == '\t' || *value == ',')
+      value++;
+    if (!strncasecmp(value, token, len) &&
+        (value[len] == '\0' || strchr(" \t,=\r\n", value[len])))
+      return 1;
+    while (*value && *value != ',')
+      value++;
+  }
+  return 0;
+}
+
+/*
+ * http://host[:port]/path (CONNECT 는 host:port) 를 나눈다. uri 는 고치지 않는다.
+ * path 는 uri 안의 뷰이고(uri 와 같이 NUL 로 끝난다), 소켓 API 에 넘길 host 와 port 는
+ * 아레나에 NUL 로 끝나는 사본으로 만든다. 메모리가 모자라면 -1
+ */
+int parse_uri(arena_t *a, const char *uri, char **hostname, char **port, const char **path)
+{
+  const char *hostbegin, *hostend, *portbegin, *pathbegin;
+
+  hostbegin = strstr(uri, "//");
+  hostbegin = (hostbegin != NULL) ? hostbegin + 2 : uri;
+
   pathbegin = strchr(hostbegin, '/');
   if (pathbegin != NULL) {
-    strcpy(path, pathbegin);
-    *pathbegin = '\0';
+    *path = pathbegin;
+    hostend = pathbegin;
   }
   else {
-    strcpy(path, "/");
+    *path = "/";
+    hostend = hostbegin + strlen(hostbegin);
   }
- 
-  portbegin = strchr(hostbegin, ':');
+
+  portbegin = memchr(hostbegin, ':', hostend - hostbegin);
   if (portbegin != NULL) {
-    *portbegin = '\0';                
-    strcpy(hostname, hostbegin);
-    strcpy(port, portbegin + 1);      
-  } 
+    *hostname = arena_strndup(a, hostbegin, portbegin - hostbegin);
+    *port = arena_strndup(a, portbegin + 1, hostend - portbegin - 1);
+  }
   else {
-    strcpy(hostname, hostbegin);
-    strcpy(port, "80");       
-   }
-}
-
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
-{
-  char buf[MAXLINE], body[MAXLINE];
-  sprintf(body, "<html><title>Tiny Error</title></html>");
-  sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-  sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n</body>", body);
-
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body)); 
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+    *hostname = arena_strndup(a, hostbegin, hostend - hostbegin);
+    *port = arena_strndup(a, "80", 2);
+  }
+  return *hostname && *port ? 0 : -1;
+}
+
+void clienterror(resp_t *r, char *cause, char *errnum, char *shortmsg, char *longmsg)
+{
+  rio_writer_t hdr, body;
+  struct iovec iov[2];
+
+  // 본문과 헤더를 각각 출력 버퍼에 한 번에 조립한다. fd 로 flush 하지 않고 응답 큐로 넘긴다
+  rio_writeinitb(&body, -1);
+  rio_writeinitb(&hdr, -1);
+  if (rio_printfb(&body, "<html><title>Tiny Error</title></html>"
+                         "<body bgcolor=""ffffff"">\r\n"
+                         "%s: %s\r\n"
+                         "<p>%s: %s\r\n"
+                         "<hr><em>The Tiny Web server</em>\r\n</body>",
+                  errnum, shortmsg, longmsg, cause) == 0 &&
+      rio_printfb(&hdr, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n",
+                  errnum, shortmsg, (int)body.rio_len) == 0) {
+    // 응답 큐를 거쳐 요청 순서대로 나간다. 클라이언트가 이미 끊었으면 조용히 버려진다
+    // 헤더와 본문을 writev 한 번으로 보내 작은 패킷 여러 개로 쪼개지지 않게 한다
+    iov[0].iov_base = hdr.rio_buf;
+    iov[0].iov_len = hdr.rio_len;
+    iov[1].iov_base = body.rio_buf;
+    iov[1].iov_len = body.rio_len;
+    resp_writev(r, iov, 2);
+  }
+  rio_writefreeb(&hdr);
+  rio_writefreeb(&body);
 }
\ No newline at end of file
@@ -0,0 +1,223 @@
+/*
+ * relay.c - Moving bytes between descriptors inside the kernel
+ */
+/* $begin relay.c */
+#define _GNU_SOURCE  /* splice() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "relay.h"
+
+#define RELAY_MAX_CHUNK (1 << 20)
+
+/* relay_splice 가 쓰는 스레드별 파이프와, 그 용량에 맞춘 한 번에 옮길 크기 */
+typedef struct {
+    int pfd[2];
+    size_t chunk;
+} relay_pipe_t;
+
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_once = PTHREAD_ONCE_INIT;
+
+/*
+ * 한 번에 옮길 크기: 목적지 소켓의 송신 버퍼 크기에 맞춘다.
+ * 그보다 작으면 시스템 콜만 늘고, 크면 어차피 커널이 나눠 받는다.
+ */
+static size_t relay_chunk(int to)
+{
+    int sndbuf;
+    socklen_t optlen = sizeof(sndbuf);
+
+    if (getsockopt(to, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0 || sndbuf < SPLICE_CHUNK)
+        return SPLICE_CHUNK;
+    return sndbuf > RELAY_MAX_CHUNK ? RELAY_MAX_CHUNK : sndbuf;
+}
+
+static void pipe_free(void *arg)
+{
+    relay_pipe_t *p = arg;
+
+    close(p->pfd[0]);
+    close(p->pfd[1]);
+    free(p);
+}
+
+static void pipe_key_init(void)
+{
+    pthread_key_create(&pipe_key, pipe_free);
+}
+
+/*
+ * 이 스레드의 파이프. 처음 부를 때 만들고, 용량을 to 의 송신 버퍼 크기로 키워 둔다.
+ * 그래서 파이프 생성, 용량 조정, getsockopt 는 스레드마다 한 번뿐이다. 못 만들면 NULL
+ */
+static relay_pipe_t *pipe_get(int to)
+{
+    relay_pipe_t *p;
+    int psize;
+
+    pthread_once(&pipe_once, pipe_key_init);
+    if ((p = pthread_getspecific(pipe_key)) != NULL)
+        return p;
+    if ((p = malloc(sizeof(relay_pipe_t))) == NULL)
+        return NULL;
+    if (pipe(p->pfd) < 0) {
+        free(p);
+        return NULL;
+    }
+    /* 파이프 용량도 같은 크기로 키운다. 실패하면 기본 용량 그대로 */
+    p->chunk = relay_chunk(to);
+    if (p->chunk > SPLICE_CHUNK) {
+        fcntl(p->pfd[1], F_SETPIPE_SZ, (int)p->chunk);
+        p->chunk = (psize = fcntl(p->pfd[1], F_GETPIPE_SZ)) > 0 ? (size_t)psize : SPLICE_CHUNK;
+    }
+    pthread_setspecific(pipe_key, p);
+    return p;
+}
+
+/* 바이트가 남은 채로 실패한 파이프는 다음 호출에 섞이므로 버린다. 다음 호출이 새로 만든다 */
+static void pipe_drop(relay_pipe_t *p)
+{
+    pthread_setspecific(pipe_key, NULL);
+    pipe_free(p);
+}
+
+/* splice 를 못 쓸 때의 대체 경로: 유저 버퍼를 거쳐 큰 덩어리로 복사 */
+static ssize_t relay_copy(int from, int to, size_t len, size_t chunk)
+{
+    char *buf, *bufp;
+    ssize_t n, m, total = 0;
+
+    if ((buf = malloc(chunk)) == NULL)
+        return -1;
+    while (len > 0) {
+        if ((n = read(from, buf, len < chunk ? len : chunk)) < 0) {
+            if (errno == EINTR)
+                continue;
+            free(buf);
+            return -1;
+        }
+        if (n == 0)
+            break;  /* EOF */
+        for (bufp = buf; n > 0; bufp += m, n -= m) {
+            if ((m = write(to, bufp, n)) < 0) {
+                if (errno == EINTR) {
+                    m = 0;
+                    continue;
+                }
+                free(buf);
+                return -1;
+            }
+            total += m;
+            if (len != RELAY_EOF)
+                len -= m;
+        }
+    }
+    free(buf);
+    return total;
+}
+
+ssize_t relay_splice(int from, int to, size_t len)
+{
+    relay_pipe_t *p;
+    size_t chunk;
+    ssize_t n, m, total = 0;
+    int more, err;
+
+    if ((p = pipe_get(to)) == NULL)
+        return relay_copy(from, to, len, SPLICE_CHUNK);
+    chunk = p->chunk;
+
+    while (len > 0) {
+        n = splice(from, NULL, p->pfd[1], NULL, len < chunk ? len : chunk, SPLICE_F_MOVE);
+        if (n == 0)
+            break;  /* EOF */
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            /* 파이프는 비어 있으니 그대로 둔다 */
+            if (errno == EINVAL && total == 0)  /* splice 미지원 fd */
+                return relay_copy(from, to, len, chunk);
+            return -1;
+        }
+        /* 뒤에 더 보낼 것이 확실할 때만 MORE: 마지막 조각은 바로 나가야 한다 */
+        more = len != RELAY_EOF && len > (size_t)n ? SPLICE_F_MORE : 0;
+        while (n > 0) {  /* 파이프에 들어간 만큼 모두 비운다 */
+            if ((m = splice(p->pfd[0], NULL, to, NULL, n, SPLICE_F_MOVE | more)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                err = errno;
+                pipe_drop(p);
+                errno = err;
+                return -1;
+            }
+            n -= m;
+            total += m;
+            if (len != RELAY_EOF)
+                len -= m;
+        }
+    }
+    return total;
+}
+
+int relay_half_init(relay_half_t *h, int from, int to)
+{
+    h->from = from;
+    h->to = to;
+    h->pending = 0;
+    h->eof = 0;
+    h->shut = 0;
+    return pipe2(h->pipefd, O_NONBLOCK);
+}
+
+void relay_half_close(relay_half_t *h)
+{
+    close(h->pipefd[0]);
+    close(h->pipefd[1]);
+}
+
+int relay_half_done(const relay_half_t *h)
+{
+    return h->eof && h->pending == 0;
+}
+
+ssize_t relay_half_pump(relay_half_t *h)
+{
+    ssize_t n, moved = 0;
+
+    for (;;) {
+        if (h->pending > 0) {  /* 파이프부터 비운다 */
+            n = splice(h->pipefd[0], NULL, h->to, NULL, h->pending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN ? moved : -1;
+            }
+            h->pending -= n;
+            moved += n;
+            continue;
+        }
+        if (h->eof) {
+            if (!h->shut) {  /* 반대편에도 EOF 를 전한다 (half-close) */
+                shutdown(h->to, SHUT_WR);
+                h->shut = 1;
+            }
+            return moved;
+        }
+        n = splice(h->from, NULL, h->pipefd[1], NULL, SPLICE_CHUNK,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+            h->eof = 1;
+        else if (n > 0)
+            h->pending += n;
+        else if (errno == EINTR)
+            continue;
+        else
+            return errno == EAGAIN ? moved : -1;
+    }
+}
+/* $end relay.c */
@@ -0,0 +1,44 @@
+/*
+ * relay.h - Moving bytes between descriptors inside the kernel
+ */
+/* $begin relay.h */
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <sys/types.h>
+
+#define RELAY_EOF    ((size_t)-1)   /* len 인자: EOF 까지 */
+#define SPLICE_CHUNK 65536          /* 한 번의 splice로 옮길 최대 바이트 (기본 파이프 용량) */
+
+/*
+ * from 에서 to 로 len 바이트(또는 EOF 까지)를 옮긴다.
+ * from -> 파이프 -> to 로 splice 해서 데이터가 유저 공간을 거치지 않는다.
+ * 파이프는 스레드마다 하나를 만들어 두고 계속 쓴다(스레드가 끝나면 닫힌다).
+ * splice 를 쓸 수 없는 fd 조합이면 read/write 복사로 대신한다.
+ * 어느 쪽이든 한 번에 송신 버퍼 크기(파이프를 만들 때 재 둔 값)만큼 옮긴다.
+ * 옮긴 바이트 수, 오류면 -1 (errno 설정)
+ */
+ssize_t relay_splice(int from, int to, size_t len);
+
+/*
+ * 터널의 한 방향(from -> 파이프 -> to). 두 fd 모두 non-blocking 이어야 하고,
+ * relay_half_pump 는 어느 쪽이든 EAGAIN 이 날 때까지 옮긴 뒤 돌아온다.
+ * 그래서 edge-triggered epoll 과 함께 쓸 수 있다.
+ */
+typedef struct {
+    int from, to;
+    int pipefd[2];
+    size_t pending;     /* 파이프에 들어 있는 바이트 */
+    int eof;            /* from 이 EOF 를 보냈다 (다 비우면 to 를 SHUT_WR) */
+    int shut;
+} relay_half_t;
+
+int relay_half_init(relay_half_t *h, int from, int to);
+void relay_half_close(relay_half_t *h);
+/* 막힐 때까지 옮긴다. 옮긴 바이트 수, 오류면 -1 */
+ssize_t relay_half_pump(relay_half_t *h);
+/* EOF 를 받았고 파이프도 다 비웠다 */
+int relay_half_done(const relay_half_t *h);
+
+#endif /* __RELAY_H__ */
+/* $end relay.h */
@@ -0,0 +1,249 @@
+/*
+ * respq.c - Per-connection response queue for pipelined requests
+ *
+ * head 응답의 생산자는 소켓에 직접 쓰고(본문은 splice), 나머지는 버퍼에 모은다.
+ * 완료된 응답이 head 가 되면 resp_done 을 부른 스레드 하나(draining)가
+ * 이어지는 완료 응답들을 순서대로 내보낸다. 소켓에 쓰는 스레드는 항상 하나뿐이다.
+ */
+/* $begin respq.c */
+#include "csapp.h"
+#include "relay.h"
+#include "respq.h"
+
+void respq_init(respq_t *q, int fd)
+{
+    q->fd = fd;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->head = q->tail = NULL;
+    q->count = 0;
+    q->draining = 0;
+    q->closing = 0;
+    q->error = 0;
+    rio_zcinit(&q->zc);
+}
+
+void respq_destroy(respq_t *q)
+{
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+resp_t *respq_push(respq_t *q)
+{
+    resp_t *r = Malloc(sizeof(resp_t));
+
+    r->next = NULL;
+    r->q = q;
+    r->buf = NULL;
+    r->len = r->cap = 0;
+    r->done = 0;
+    r->keep = 0;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->tail)
+        q->tail->next = r;
+    else
+        q->head = r;
+    q->tail = r;
+    q->count++;
+    pthread_mutex_unlock(&q->mutex);
+    return r;
+}
+
+int respq_pending(respq_t *q)
+{
+    int n;
+
+    pthread_mutex_lock(&q->mutex);
+    n = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+int respq_wait(respq_t *q)
+{
+    int keep;
+
+    pthread_mutex_lock(&q->mutex);
+    while (q->head)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    keep = !q->error && !q->closing;
+    pthread_mutex_unlock(&q->mutex);
+    return keep;
+}
+
+/* 클라이언트 쓰기 실패: 대기 중인 생산자들을 모두 깨워 그만두게 한다 */
+static void respq_fail(respq_t *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->error = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* head 가 된 응답이 그동안 모아 둔 바이트를 내보낸다. 락 밖에서 호출 */
+static int resp_flush(resp_t *r)
+{
+    if (r->len == 0)
+        return 0;
+    if (rio_writen(r->q->fd, r->buf, r->len) < 0)
+        return -1;
+    r->len = 0;
+    return 0;
+}
+
+/* 락을 잡은 채로 버퍼 뒤에 붙인다 */
+static void resp_append(resp_t *r, const void *buf, size_t n)
+{
+    if (r->len + n > r->cap) {
+        r->cap = r->cap ? r->cap : 8192;
+        while (r->cap < r->len + n)
+            r->cap *= 2;
+        r->buf = Realloc(r->buf, r->cap);
+    }
+    memcpy(r->buf + r->len, buf, n);
+    r->len += n;
+}
+
+int resp_write(resp_t *r, const void *buf, size_t n)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = n;
+    return resp_writev(r, &iov, 1);
+}
+
+/* zc 면 차례가 된 응답을 rio_writev_zc 로 보낸다 */
+static int writev_mode(resp_t *r, struct iovec *iov, int iovcnt, int zc)
+{
+    respq_t *q = r->q;
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        n += iov[i].iov_len;
+    pthread_mutex_lock(&q->mutex);
+    /* 차례가 아닌데 버퍼가 찼으면 앞 응답들이 빠질 때까지 기다린다 */
+    while (r != q->head && r->len > 0 && r->len + n > RESP_BUF_MAX && !q->error)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    if (q->error || q->closing) {
+        pthread_mutex_unlock(&q->mutex);
+        return -1;
+    }
+    if (r != q->head) {
+        for (i = 0; i < iovcnt; i++)
+            resp_append(r, iov[i].iov_base, iov[i].iov_len);
+        pthread_mutex_unlock(&q->mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    if (resp_flush(r) < 0 ||
+        (zc ? rio_writev_zc(q->fd, iov, iovcnt, &q->zc) : rio_writev(q->fd, iov, iovcnt)) < 0) {
+        respq_fail(q);
+        return -1;
+    }
+    return 0;
+}
+
+int resp_writev(resp_t *r, struct iovec *iov, int iovcnt)
+{
+    return writev_mode(r, iov, iovcnt, 0);
+}
+
+int resp_writev_zc(resp_t *r, struct iovec *iov, int iovcnt)
+{
+    return writev_mode(r, iov, iovcnt, 1);
+}
+
+static int resp_is_head(resp_t *r)
+{
+    int head;
+
+    pthread_mutex_lock(&r->q->mutex);
+    head = (r == r->q->head);
+    pthread_mutex_unlock(&r->q->mutex);
+    return head;
+}
+
+/* 차례가 아닌 응답은 zero-copy 로 보낸 적이 없다. 소켓이 망가져도 커널이 버퍼를 놓을 때까지는 기다린다 */
+int resp_zc_wait(resp_t *r)
+{
+    respq_t *q = r->q;
+
+    if (!resp_is_head(r) || q->zc.rio_zc_pending == 0)
+        return 0;
+    if (rio_zc_wait(q->fd, &q->zc) < 0) {
+        respq_fail(q);
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t resp_relay(resp_t *r, int from, size_t len)
+{
+    char buf[MAXBUF];
+    size_t left = len, want;
+    ssize_t n, moved = 0;
+
+    while (left > 0) {
+        /* 차례가 되면 나머지는 커널 안에서 바로 옮긴다 */
+        if (resp_is_head(r)) {
+            if (resp_flush(r) < 0) {
+                respq_fail(r->q);
+                return -1;
+            }
+            if ((n = relay_splice(from, r->q->fd, left)) < 0)
+                return -1;
+            return moved + n;
+        }
+        want = left < sizeof(buf) ? left : sizeof(buf);
+        if ((n = read(from, buf, want)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        if (resp_write(r, buf, n) < 0)
+            return -1;
+        moved += n;
+        if (left != RELAY_EOF)
+            left -= n;
+    }
+    return moved;
+}
+
+void resp_done(resp_t *r, int keep)
+{
+    respq_t *q = r->q;
+    int ok;
+
+    pthread_mutex_lock(&q->mutex);
+    r->done = 1;
+    r->keep = keep;
+    if (!q->draining) {
+        q->draining = 1;
+        while ((r = q->head) && r->done) {
+            ok = !q->error && !q->closing;
+            pthread_mutex_unlock(&q->mutex);
+            if (ok && resp_flush(r) < 0)
+                respq_fail(q);
+            pthread_mutex_lock(&q->mutex);
+            if (!r->keep)
+                q->closing = 1;
+            q->head = r->next;
+            if (!q->head)
+                q->tail = NULL;
+            q->count--;
+            Free(r->buf);
+            Free(r);
+        }
+        q->draining = 0;
+    }
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+/* $end respq.c */
@@ -0,0 +1,66 @@
+/*
+ * respq.h - Per-connection response queue for pipelined requests
+ *
+ * 한 연결에서 파이프라인된 요청들은 서로 다른 스레드에서 동시에 처리되지만,
+ * 응답은 요청 순서대로 나가야 한다. 큐의 맨 앞(head) 응답만 소켓에 직접 쓰고,
+ * 나머지는 자기 차례가 올 때까지 메모리에 모아 둔다(최대 RESP_BUF_MAX, 넘으면 대기).
+ */
+/* $begin respq.h */
+#ifndef __RESPQ_H__
+#define __RESPQ_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "csapp.h"
+
+#define RESP_BUF_MAX (256 * 1024)   /* 차례를 기다리는 응답 하나가 모아 둘 수 있는 최대 바이트 */
+
+typedef struct respq respq_t;
+
+typedef struct resp {
+    struct resp *next;
+    respq_t *q;
+    char *buf;          /* 차례가 오기 전까지 모아 둔 응답 바이트 */
+    size_t len, cap;
+    int done;           /* 응답 생성이 끝났다 */
+    int keep;           /* 이 응답 뒤에도 연결을 유지할 수 있다 */
+} resp_t;
+
+struct respq {
+    int fd;                 /* 클라이언트 소켓 */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    /* head 가 바뀔 때 알림 */
+    resp_t *head, *tail;
+    int count;              /* 큐에 남은 응답 수 */
+    int draining;           /* 누군가 완료된 응답들을 내보내는 중 */
+    int closing;            /* keep-alive 가 아닌 응답이 나갔다: 이후 응답은 버린다 */
+    int error;              /* 클라이언트 쓰기 실패 */
+    rio_zc_t zc;            /* resp_writev_zc 의 zero-copy 상태. head 의 생산자만 쓴다 */
+};
+
+void respq_init(respq_t *q, int fd);
+void respq_destroy(respq_t *q);
+resp_t *respq_push(respq_t *q);
+int respq_pending(respq_t *q);
+/* 모든 응답이 나갈 때까지 기다린다. 연결을 계속 써도 되면 1 */
+int respq_wait(respq_t *q);
+
+/* 응답 바이트를 쓴다. 클라이언트로 더 보낼 수 없으면 -1 */
+int resp_write(resp_t *r, const void *buf, size_t n);
+/* 여러 조각을 한 번에 쓴다. 차례가 된 응답은 writev 한 번으로 내보낸다. iov 는 고쳐질 수 있다 */
+int resp_writev(resp_t *r, struct iovec *iov, int iovcnt);
+/*
+ * resp_writev 와 같지만 차례가 된 응답의 큰 조각은 복사 없이(MSG_ZEROCOPY) 보낸다.
+ * 보낸 바이트는 resp_zc_wait 가 돌아올 때까지 바꾸거나 놓으면 안 된다
+ */
+int resp_writev_zc(resp_t *r, struct iovec *iov, int iovcnt);
+/* 커널이 resp_writev_zc 로 넘긴 버퍼를 다 놓을 때까지 기다린다. 클라이언트 소켓이 망가졌으면 -1 */
+int resp_zc_wait(resp_t *r);
+/* from 에서 len 바이트(또는 EOF 까지)를 응답 본문으로 옮긴다. 차례가 된 응답은 splice 한다 */
+ssize_t resp_relay(resp_t *r, int from, size_t len);
+/* 응답 완료. keep 이 0 이면 이 응답 뒤에 연결을 닫는다 */
+void resp_done(resp_t *r, int keep);
+
+#endif /* __RESPQ_H__ */
+/* $end respq.h */
@@ -0,0 +1,206 @@
+/*
+ * scan.c - SIMD byte scanning kernels for the HTTP parsers
+ *
+ * 구분자 찾기는 비교 후 movemask 로 일치한 바이트의 비트를 모아 ctz 로 첫 위치를 얻는다.
+ * token 판별은 바이트를 상위/하위 니블로 나눠 두 16바이트 표를 pshufb 로 찾고
+ * AND 한다(hi_tbl[hi] & lo_tbl[lo] 가 0 이 아니면 token 문자). token 집합은
+ * 범위 8개(pcmpestri 의 한계)로 나타낼 수 없어서 범위 비교 대신 이 방법을 쓴다.
+ * 벡터 폭보다 짧은 꼬리는 스칼라로 처리한다.
+ */
+/* $begin scan.c */
+#include <string.h>
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* token 문자면 1 */
+static unsigned char tchar[256];
+
+/* 니블 표: 0x80 이상은 hi_tbl 이 0 이라 token 이 아니다 */
+static unsigned char lo_tbl[16], hi_tbl[16];
+
+static const char *chr_scalar(const char *p, size_t len, int c)
+{
+    return memchr(p, c, len);
+}
+
+static size_t token_scalar(const char *p, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len && tchar[(unsigned char)p[i]]; i++)
+        ;
+    return i;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse4.2")))
+static const char *chr_sse42(const char *p, size_t len, int c)
+{
+    __m128i needle = _mm_set1_epi8((char)c);
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), needle));
+        if (mask)
+            return p + i + __builtin_ctz(mask);
+    }
+    return chr_scalar(p + i, len - i, c);
+}
+
+/* 16바이트 중 token 이 아닌 바이트의 비트 마스크 */
+__attribute__((target("sse4.2")))
+static inline int nontoken_mask16(__m128i v, __m128i lo, __m128i hi)
+{
+    __m128i nib = _mm_set1_epi8(0x0f);
+    __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nib));
+    __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128()));
+}
+
+__attribute__((target("sse4.2")))
+static size_t token_sse42(const char *p, size_t len)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i *)lo_tbl);
+    __m128i hi = _mm_loadu_si128((const __m128i *)hi_tbl);
+    size_t i;
+    int mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        mask = nontoken_mask16(_mm_loadu_si128((const __m128i *)(p + i)), lo, hi);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + token_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char *chr_avx2(const char *p, size_t len, int c)
+{
+    __m256i needle = _mm256_set1_epi8((char)c);
+    size_t i;
+    unsigned mask;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), needle));
+        if (mask)
+            return p + i + __builtin_ctz(mask);
+    }
+    /*
+     * ymm 상위 절반을 비우지 않고 SSE 코드로 넘어가면 이후 모든 SSE 명령이
+     * 전환 비용을 문다. 컴파일러가 호출 앞에 vzeroupper 를 빠뜨릴 때가 있어 직접 넣는다
+     */
+    _mm256_zeroupper();
+    return chr_sse42(p + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t token_avx2(const char *p, size_t len)
+{
+    /* vpshufb 는 128비트 lane 마다 따로 찾으므로 표를 두 lane 에 모두 싣는다 */
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo_tbl));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi_tbl));
+    __m256i nib = _mm256_set1_epi8(0x0f), v, m;
+    size_t i;
+    unsigned mask;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *)(p + i));
+        m = _mm256_and_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nib)),
+                             _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return i + token_sse42(p + i, len - i);
+}
+#endif /* SCAN_X86 */
+
+static const struct scan_ops {
+    const char *name;
+    const char *(*chr)(const char *, size_t, int);
+    size_t (*token)(const char *, size_t);
+} impls[] = {
+#ifdef SCAN_X86
+    { "avx2", chr_avx2, token_avx2 },
+    { "sse4.2", chr_sse42, token_sse42 },
+#endif
+    { "scalar", chr_scalar, token_scalar },
+};
+
+static const struct scan_ops *ops = &impls[sizeof(impls) / sizeof(impls[0]) - 1];
+
+static int supported(const struct scan_ops *o)
+{
+#ifdef SCAN_X86
+    if (!strcmp(o->name, "avx2"))
+        return __builtin_cpu_supports("avx2");
+    if (!strcmp(o->name, "sse4.2"))
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    return 1;
+}
+
+/*
+ * 표를 만들고 쓸 수 있는 가장 빠른 구현을 고른다. 스레드가 생기기 전,
+ * main 보다 먼저 한 번 불리므로 이후 읽기에는 잠금이 필요 없다.
+ */
+__attribute__((constructor))
+static void scan_init(void)
+{
+    const char *extra = "!#$%&'*+-.^_`|~";
+    size_t i;
+    int c;
+
+    for (c = 0; c < 256; c++)
+        tchar[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                   (c >= '0' && c <= '9') || (c && strchr(extra, c));
+    for (c = 0; c < 128; c++)
+        if (tchar[c])
+            lo_tbl[c & 0x0f] |= 1 << (c >> 4);
+    for (i = 0; i < 8; i++)
+        hi_tbl[i] = 1 << i;
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+#endif
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+        if (supported(&impls[i])) {
+            ops = &impls[i];
+            break;
+        }
+}
+
+const char *scan_chr(const char *p, size_t len, int c)
+{
+    return ops->chr(p, len, c);
+}
+
+size_t scan_token(const char *p, size_t len)
+{
+    return ops->token(p, len);
+}
+
+const char *scan_impl(void)
+{
+    return ops->name;
+}
+
+int scan_use(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+        if (!strcmp(impls[i].name, name) && supported(&impls[i])) {
+            ops = &impls[i];
+            return 0;
+        }
+    return -1;
+}
+/* $end scan.c */
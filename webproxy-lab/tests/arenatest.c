@@ -0,0 +1,117 @@
+/*
+ * arenatest.c - Bump-pointer arena: inline block, overflow blocks, spare reuse
+ *
+ * usage: arenatest   (실패하면 어느 검사인지 찍고 1 로 끝난다)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+static int failed;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failed = 1; \
+    } \
+} while (0)
+
+/* p[0..n) 가 지금 넘친 블록 안, 이미 나눠 준 자리에 있다 */
+static int in_block(const arena_t *a, const char *p, size_t n)
+{
+    const char *start = (const char *)(a->blocks + 1);
+
+    return p >= start && p + n <= a->ptr && a->ptr <= a->end && a->end <= start + a->blocks->size;
+}
+
+/* 첫 블록에 들어가는 것은 그 안에서, 정렬을 지켜 나눠 준다 */
+static void test_inline(void)
+{
+    char buf[256];
+    arena_t a;
+    char *p, *q;
+
+    arena_init(&a, buf, sizeof(buf));
+    p = arena_alloc(&a, 10);
+    q = arena_alloc(&a, 10);
+    CHECK(p == buf);
+    CHECK(q == buf + ARENA_ALIGN);
+    CHECK(a.blocks == NULL);
+    p = arena_strndup(&a, "hello world", 5);
+    CHECK(p != NULL && !strcmp(p, "hello"));
+    CHECK(((uintptr_t)p & (ARENA_ALIGN - 1)) == 0);
+    arena_free(&a);
+}
+
+/* 넘치면 블록을 더 받고, 되감으면 첫 블록부터 다시 쓴다 */
+static void test_overflow(void)
+{
+    char buf[64];
+    arena_t a;
+    char *p;
+
+    arena_init(&a, buf, sizeof(buf));
+    p = arena_alloc(&a, 100);
+    CHECK(p != NULL && a.blocks != NULL && in_block(&a, p, 100));
+    memset(p, 'x', 100);
+    p = arena_alloc(&a, 3 * ARENA_BLOCK);  /* 직전 블록의 두 배로도 모자라면 더 키운다 */
+    CHECK(p != NULL && in_block(&a, p, 3 * ARENA_BLOCK));
+    memset(p, 'y', 3 * ARENA_BLOCK);
+    arena_reset(&a);
+    CHECK(a.blocks == NULL && a.ptr == buf && a.end == buf + sizeof(buf));
+    arena_free(&a);
+    CHECK(a.spare == NULL);
+}
+
+/*
+ * 되감을 때 남긴 가장 큰 블록을 다음에 넘칠 때 그대로 다시 쓴다.
+ * 다시 쓴 블록의 끝(a->end)이 그 블록 크기대로 잡혀야 뒤따르는 할당이 그 안에 머문다
+ */
+static void test_spare(void)
+{
+    char buf[256];
+    arena_t a;
+    arena_block_t *spare;
+    size_t size;
+    char *p, *q;
+    int round;
+
+    arena_init(&a, buf, sizeof(buf));
+    arena_alloc(&a, 5000);
+    arena_alloc(&a, 100);
+    arena_reset(&a);
+    CHECK(a.blocks == NULL && a.spare != NULL);
+    spare = a.spare;
+    for (round = 0; round < 3; round++) {
+        p = arena_alloc(&a, 5000);
+        CHECK(a.blocks == spare && a.spare == NULL);
+        CHECK(a.end == (char *)(spare + 1) + spare->size);
+        CHECK(a.ptr <= a.end && in_block(&a, p, 5000));
+        q = arena_alloc(&a, 100);   /* 남은 자리에 들어가면 새 블록을 받지 않는다 */
+        CHECK(a.blocks == spare && in_block(&a, q, 100));
+        memset(p, 'x', 5000);
+        memset(q, 'y', 100);
+        arena_reset(&a);
+        CHECK(a.spare == spare);
+    }
+
+    /* 남긴 블록보다 크면 새로 받고, 되감을 때는 더 큰 쪽을 남긴다 */
+    size = spare->size;
+    p = arena_alloc(&a, 4 * size);
+    CHECK(p != NULL && a.spare == spare && a.blocks != spare);
+    arena_reset(&a);
+    CHECK(a.spare != NULL && a.spare->size >= 4 * size);
+    arena_free(&a);
+    CHECK(a.spare == NULL && a.blocks == NULL);
+}
+
+int main(void)
+{
+    test_inline();
+    test_overflow();
+    test_spare();
+    printf("arenatest: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
@@ -0,0 +1,88 @@
+/*
+ * chunkedtest.c - Chunked decoder: body framing accepted and rejected
+ *
+ * usage: chunkedtest   (실패하면 어느 입력인지 찍고 1 로 끝난다)
+ *
+ * 프록시는 요청 본문의 끝을 이 디코더로 찾는다. origin 과 끝을 다르게 볼 수 있는 틀은
+ * 모두 오류여야 한다.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "chunked.h"
+
+static int failed;
+
+/*
+ * in 을 step 바이트씩 나눠 넣어 끝까지 디코드한다. 1: 끝, -1: 오류, 0: 덜 왔다.
+ * 끝나면 *used 에 소비한 바이트 수, body 에 본문을 모은다
+ */
+static int decode(const char *in, size_t len, size_t step, size_t *used, char *body, size_t *bodylen)
+{
+    chunked_t d;
+    const char *data;
+    size_t off = 0, n, datalen, end;
+
+    chunked_init(&d);
+    *bodylen = 0;
+    end = step < len ? step : len;
+    while (chunked_done(&d) == 0 && off < len) {
+        n = chunked_decode(&d, in + off, end - off, &data, &datalen);
+        memcpy(body + *bodylen, data, datalen);
+        *bodylen += datalen;
+        off += n;
+        if (off == end)
+            end = end + step < len ? end + step : len;
+    }
+    *used = off;
+    return chunked_done(&d);
+}
+
+static void accept_case(const char *in, const char *want, size_t rest)
+{
+    char body[256];
+    size_t step, used, bodylen, len = strlen(in);
+
+    for (step = 1; step <= len; step++) {
+        if (decode(in, len, step, &used, body, &bodylen) != 1 || used != len - rest ||
+            bodylen != strlen(want) || memcmp(body, want, bodylen)) {
+            fprintf(stderr, "should accept (step %zu): %s\n", step, in);
+            failed = 1;
+            return;
+        }
+    }
+}
+
+static void reject_case(const char *in)
+{
+    char body[256];
+    size_t used, bodylen;
+
+    if (decode(in, strlen(in), strlen(in), &used, body, &bodylen) != -1) {
+        fprintf(stderr, "should reject: %s\n", in);
+        failed = 1;
+    }
+}
+
+int main(void)
+{
+    accept_case("5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", "hello world", 0);
+    accept_case("5;name=val\r\nhello\r\n0\r\n\r\n", "hello", 0);
+    accept_case("A\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\n", "0123456789", 0);
+    accept_case("5\nhello\n0\n\n", "hello", 0);
+    accept_case("5\r\nhello\r\n0\r\n\r\nGET / HTTP/1.1\r\n", "hello", 16);  /* 뒤따르는 요청은 소비하지 않는다 */
+
+    reject_case("-1\r\nhello\r\n0\r\n\r\n");
+    reject_case("+5\r\nhello\r\n0\r\n\r\n");
+    reject_case("0x5\r\nhello\r\n0\r\n\r\n");
+    reject_case(" 5\r\nhello\r\n0\r\n\r\n");
+    reject_case("\r\n0\r\n\r\n");
+    reject_case("zz\r\n0\r\n\r\n");
+    reject_case("10000000000000005\r\nhello\r\n0\r\n\r\n");  /* 자릿수 상한 */
+    reject_case("ffffffffffffffff\r\nhello\r\n0\r\n\r\n");
+    reject_case("5\r\nhelloXX0\r\n\r\n");                     /* 데이터 뒤에 CRLF 가 없다 */
+    reject_case("5\rxhello\r\n0\r\n\r\n");
+    reject_case("0\r\n\rx");
+
+    printf("chunkedtest: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
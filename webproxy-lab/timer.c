@@ -0,0 +1,217 @@
+/*
+ * timer.c - Hierarchical timing wheel
+ *
+ * 레벨 0 은 1 tick 단위 64 슬롯, 레벨 L 은 64^L tick 단위 64 슬롯이다.
+ * 타이머는 남은 시간에 맞는 레벨에 들어가고, 하위 레벨이 한 바퀴 돌 때마다
+ * 상위 레벨의 슬롯 하나가 아래로 내려온다(cascade). 따라서 삽입/취소는 O(1),
+ * 만료 처리는 타이머당 최대 TW_LEVELS 번의 재배치로 끝난다.
+ */
+/* $begin timer.c */
+#include <time.h>
+#include "timer.h"
+
+uint64_t tw_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void list_init(tw_timer_t *head)
+{
+    head->next = head->prev = head;
+}
+
+static void list_unlink(tw_timer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+/* expires 까지 남은 tick 으로 레벨/슬롯을 골라 넣는다. expires >= now 가정 */
+static void tw_place(tw_wheel_t *w, tw_timer_t *t)
+{
+    uint64_t delta = t->expires - w->now;
+    int level = 0, idx;
+    tw_timer_t *head;
+
+    if (delta > TW_MAX_TICKS) {
+        t->expires = w->now + TW_MAX_TICKS;
+        delta = TW_MAX_TICKS;
+    }
+    while (level < TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_BITS * (level + 1))))
+        level++;
+    idx = (t->expires >> (TW_BITS * level)) & TW_MASK;
+
+    head = &w->slots[level][idx];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    w->bitmap[level] |= (uint64_t)1 << idx;
+}
+
+void tw_init(tw_wheel_t *w, unsigned tick_ms, uint64_t now_ms)
+{
+    int l, i;
+
+    w->now = 0;
+    w->base_ms = now_ms;
+    w->tick_ms = tick_ms ? tick_ms : 1;
+    w->count = 0;
+    for (l = 0; l < TW_LEVELS; l++) {
+        w->bitmap[l] = 0;
+        for (i = 0; i < TW_SLOTS; i++)
+            list_init(&w->slots[l][i]);
+    }
+}
+
+void tw_timer_init(tw_timer_t *t, tw_handler_t *handler, void *arg)
+{
+    t->next = t->prev = NULL;
+    t->expires = 0;
+    t->handler = handler;
+    t->arg = arg;
+}
+
+int tw_pending(const tw_timer_t *t)
+{
+    return t->next != NULL;
+}
+
+/* 절대 시각(ms)에 만료되도록 등록. 이미 등록돼 있으면 다시 건다. */
+void tw_add_at(tw_wheel_t *w, tw_timer_t *t, uint64_t when_ms)
+{
+    uint64_t expires = 0;
+
+    if (tw_pending(t))
+        tw_del(w, t);
+    if (when_ms > w->base_ms)
+        expires = (when_ms - w->base_ms + w->tick_ms - 1) / w->tick_ms;
+    if (expires <= w->now)
+        expires = w->now + 1;   /* 최소 다음 tick */
+    t->expires = expires;
+    tw_place(w, t);
+    w->count++;
+}
+
+void tw_add(tw_wheel_t *w, tw_timer_t *t, unsigned timeout_ms)
+{
+    tw_add_at(w, t, tw_now_ms() + timeout_ms);
+}
+
+void tw_del(tw_wheel_t *w, tw_timer_t *t)
+{
+    tw_timer_t *head;
+    uintptr_t pos;
+
+    if (!tw_pending(t))
+        return;
+    /* 슬롯에 혼자 있었다면 이웃이 곧 센티넬이므로, 그 위치로 비트를 지운다 */
+    head = t->next;
+    pos = head - &w->slots[0][0];
+    if (head == t->prev && pos < TW_LEVELS * TW_SLOTS) {
+        w->bitmap[pos / TW_SLOTS] &= ~((uint64_t)1 << (pos % TW_SLOTS));
+    }
+    list_unlink(t);
+    w->count--;
+}
+
+/* level 의 idx 슬롯을 현재 now 기준으로 다시 배치 */
+static void tw_cascade(tw_wheel_t *w, int level, int idx)
+{
+    tw_timer_t *head = &w->slots[level][idx], *t;
+
+    w->bitmap[level] &= ~((uint64_t)1 << idx);
+    while ((t = head->next) != head) {
+        list_unlink(t);
+        tw_place(w, t);
+    }
+}
+
+/* now 에 해당하는 레벨 0 슬롯의 타이머를 한꺼번에 만료시킨다 */
+static size_t tw_expire(tw_wheel_t *w)
+{
+    tw_timer_t *head = &w->slots[0][w->now & TW_MASK], batch, *t;
+    size_t fired = 0;
+
+    if (head->next == head)
+        return 0;
+
+    /* 핸들러가 다른 타이머를 추가/삭제해도 안전하도록 슬롯을 지역 리스트로 옮긴다 */
+    batch.next = head->next;
+    batch.prev = head->prev;
+    batch.next->prev = &batch;
+    batch.prev->next = &batch;
+    list_init(head);
+    w->bitmap[0] &= ~((uint64_t)1 << (w->now & TW_MASK));
+
+    while ((t = batch.next) != &batch) {
+        list_unlink(t);
+        w->count--;
+        t->handler(t, t->arg);
+        fired++;
+    }
+    return fired;
+}
+
+size_t tw_advance(tw_wheel_t *w, uint64_t now_ms)
+{
+    uint64_t target, next, wrap, mask;
+    size_t fired = 0;
+    int level;
+
+    if (now_ms <= w->base_ms)
+        return 0;
+    target = (now_ms - w->base_ms) / w->tick_ms;
+
+    while (w->now < target) {
+        if (w->count == 0) {     /* 빈 휠은 그냥 시간만 옮긴다 */
+            w->now = target;
+            break;
+        }
+
+        /* 이번 바퀴 안에서 다음으로 차 있는 레벨 0 슬롯까지 건너뛴다 */
+        wrap = (w->now | TW_MASK) + 1;
+        next = wrap;
+        mask = (w->now & TW_MASK) == TW_MASK ? 0
+             : w->bitmap[0] & (~(uint64_t)0 << ((w->now & TW_MASK) + 1));
+        if (mask)
+            next = (w->now & ~(uint64_t)TW_MASK) + __builtin_ctzll(mask);
+        w->now = next < target ? next : target;
+
+        /* 레벨 0 이 한 바퀴 돌면 상위 레벨 슬롯을 내려보낸다 */
+        for (level = 1; level < TW_LEVELS; level++) {
+            if ((w->now & (((uint64_t)1 << (TW_BITS * level)) - 1)) != 0)
+                break;
+            tw_cascade(w, level, (w->now >> (TW_BITS * level)) & TW_MASK);
+        }
+        fired += tw_expire(w);
+    }
+    return fired;
+}
+
+int tw_next_timeout(const tw_wheel_t *w, uint64_t now_ms)
+{
+    uint64_t next, when, mask;
+
+    if (w->count == 0)
+        return -1;
+
+    /* 레벨 0 에 남은 가장 가까운 슬롯, 없으면 다음 cascade 시점 */
+    next = (w->now | TW_MASK) + 1;
+    mask = (w->now & TW_MASK) == TW_MASK ? 0
+         : w->bitmap[0] & (~(uint64_t)0 << ((w->now & TW_MASK) + 1));
+    if (mask)
+        next = (w->now & ~(uint64_t)TW_MASK) + __builtin_ctzll(mask);
+
+    when = w->base_ms + next * w->tick_ms;
+    if (when <= now_ms)
+        return 0;
+    if (when - now_ms > 0x7fffffff)
+        return 0x7fffffff;
+    return (int)(when - now_ms);
+}
+/* $end timer.c */
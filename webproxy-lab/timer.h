@@ -0,0 +1,58 @@
+/*
+ * timer.h - Hierarchical timing wheel for connection timeouts
+ *
+ * 타이머는 호출자 구조체에 내장(intrusive)되고, 삽입/취소는 O(1)이다.
+ * 만료는 tick 단위로 슬롯 전체를 한 번에 처리한다.
+ * 휠 자체는 스레드 안전하지 않다. 소유 스레드(이벤트 루프)에서만 호출할 것.
+ */
+/* $begin timer.h */
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_BITS   6                    /* 레벨당 슬롯 수 = 2^6 */
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 4                    /* 64^4 tick 까지 표현 */
+#define TW_MAX_TICKS (((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1)
+
+typedef struct tw_timer tw_timer_t;
+typedef void tw_handler_t(tw_timer_t *t, void *arg);
+
+struct tw_timer {
+    tw_timer_t *next;          /* 슬롯 리스트 링크 (NULL이면 미등록) */
+    tw_timer_t *prev;
+    uint64_t expires;          /* 만료 tick (절대값) */
+    tw_handler_t *handler;     /* 만료 시 호출 */
+    void *arg;
+};
+
+typedef struct {
+    uint64_t now;              /* 현재 tick */
+    uint64_t base_ms;          /* tick 0 의 시각(ms, monotonic) */
+    unsigned tick_ms;          /* tick 길이 */
+    size_t count;              /* 등록된 타이머 수 */
+    uint64_t bitmap[TW_LEVELS];               /* 비어있지 않은 슬롯 표시 */
+    tw_timer_t slots[TW_LEVELS][TW_SLOTS];    /* 슬롯 리스트 헤드(센티넬) */
+} tw_wheel_t;
+
+/* 단조 시계(ms) */
+uint64_t tw_now_ms(void);
+
+void tw_init(tw_wheel_t *w, unsigned tick_ms, uint64_t now_ms);
+void tw_timer_init(tw_timer_t *t, tw_handler_t *handler, void *arg);
+void tw_add(tw_wheel_t *w, tw_timer_t *t, unsigned timeout_ms);
+void tw_add_at(tw_wheel_t *w, tw_timer_t *t, uint64_t when_ms);
+void tw_del(tw_wheel_t *w, tw_timer_t *t);
+int tw_pending(const tw_timer_t *t);
+
+/* now_ms 까지 시간을 진행시키고 만료된 타이머를 호출한다. 호출 수를 반환 */
+size_t tw_advance(tw_wheel_t *w, uint64_t now_ms);
+
+/* 다음에 확인해야 할 시각까지 남은 ms. 타이머가 없으면 -1 (poll/epoll 타임아웃용) */
+int tw_next_timeout(const tw_wheel_t *w, uint64_t now_ms);
+
+#endif /* __TIMER_H__ */
+/* $end timer.h */
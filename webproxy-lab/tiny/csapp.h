@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <math.h>
 #include <pthread.h>
@@ -42,15 +43,37 @@ typedef struct sockaddr SA;
 
 /* Persistent state for the robust I/O (Rio) package */
 /* $begin rio_t */
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE 8192          /* Default internal buffer size */
+#define RIO_POOL_MAX 256          /* Freed default-size buffers kept for reuse */
 typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *rio_buf;             /* Internal buffer, allocated on first read */
+    size_t rio_size;           /* Size of rio_buf; grows when a peek needs it */
 } rio_t;
 /* $end rio_t */
 
+/* Output buffer for assembling a response and writing it once */
+/* $begin rio_writer_t */
+#define RIO_WRITER_INLINE 512     /* Bytes held before moving to the heap */
+typedef struct {
+    int rio_fd;                /* Descriptor the buffer is flushed to */
+    size_t rio_len;            /* Bytes in rio_buf */
+    size_t rio_size;           /* Size of rio_buf */
+    char *rio_buf;             /* rio_inline, or a heap buffer once it grows */
+    char rio_inline[RIO_WRITER_INLINE];
+} rio_writer_t;
+/* $end rio_writer_t */
+
+/* Zero-copy send state of one socket (see rio_writev_zc_nb) */
+/* $begin rio_zc_t */
+typedef struct rio_zc {
+    int rio_zc_on;             /* SO_ZEROCOPY: 1 on, -1 off, 0 not tried */
+    unsigned int rio_zc_pending; /* MSG_ZEROCOPY sends not yet released */
+} rio_zc_t;
+/* $end rio_zc_t */
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -59,6 +82,7 @@ extern char **environ; /* Defined by libc */
 #define	MAXLINE	 8192  /* Max text line length */
 #define MAXBUF   8192  /* Max I/O buffer size */
 #define LISTENQ  1024  /* Second argument to listen() */
+#define RIO_ZC_THRESHOLD 16384 /* Smallest write sent with MSG_ZEROCOPY */
 
 /* Our own error-handling functions */
 void unix_error(char *msg);
@@ -175,16 +199,43 @@ void V(sem_t *sem);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt);
+ssize_t rio_writev_nb(int fd, struct iovec **iovp, int *iovcntp);
+void rio_zcinit(rio_zc_t *zp);
+ssize_t rio_writev_zc(int fd, struct iovec *iov, int iovcnt, rio_zc_t *zp);
+ssize_t rio_writev_zc_nb(int fd, struct iovec **iovp, int *iovcntp, rio_zc_t *zp);
+int rio_zc_reap_nb(int fd, rio_zc_t *zp);
+int rio_zc_wait(int fd, rio_zc_t *zp);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitb_size(rio_t *rp, int fd, size_t size);
+void rio_freeb(rio_t *rp);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_fillb(rio_t *rp);
+ssize_t	rio_fillb_nb(rio_t *rp);
+ssize_t	rio_peekb(rio_t *rp, char **bufp);
+ssize_t	rio_peeklineb(rio_t *rp, char **linep, size_t maxlen);
+void rio_consumeb(rio_t *rp, size_t n);
+void rio_writeinitb(rio_writer_t *wp, int fd);
+void rio_writefreeb(rio_writer_t *wp);
+int rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n);
+int rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int rio_vprintfb(rio_writer_t *wp, const char *fmt, va_list ap);
+ssize_t rio_flushb(rio_writer_t *wp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
+void Rio_writev(int fd, struct iovec *iov, int iovcnt);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_peeklineb(rio_t *rp, char **linep, size_t maxlen);
+void Rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n);
+void Rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void Rio_flushb(rio_writer_t *wp);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
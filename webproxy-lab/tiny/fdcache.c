@@ -0,0 +1,240 @@
+/*
+ * fdcache.c - Cache of open file descriptors and stat results for tiny
+ */
+/* $begin fdcache.c */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "fdcache.h"
+
+/* 파일 내용이나 경로가 바뀌는 사건. 이름을 바꿔 덮어쓰면 예전 inode 에 IN_ATTRIB(링크 수)가 온다 */
+#define FDC_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static fdc_file_t *buckets[FDC_BUCKETS];
+static fdc_file_t *lru_head, *lru_tail;  /* 앞이 최근 */
+static int count;
+static size_t bytes;                    /* 올려 둔 내용과 헤더 */
+static int inofd = -1;
+static fdc_head_fn make_head;
+static pthread_mutex_t fdc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static fdc_file_t **bucket(const char *path)
+{
+    uint32_t h = 2166136261u;           /* FNV-1a */
+
+    while (*path)
+        h = (h ^ (unsigned char)*path++) * 16777619u;
+    return &buckets[h & (FDC_BUCKETS - 1)];
+}
+
+static void release(fdc_file_t *f)
+{
+    close(f->fd);
+    free(f->head);
+    free(f->data);
+    free(f->path);
+    free(f);
+}
+
+/* 남은 항목이 더 쓰지 않는 watch 를 뗀다. 하드 링크면 다른 경로가 같은 inode 를 볼 수 있다 */
+static void unwatch(int wd)
+{
+    fdc_file_t *g;
+
+    if (wd < 0)
+        return;
+    for (g = lru_head; g && g->wd != wd; g = g->next)
+        ;
+    if (g == NULL)
+        inotify_rm_watch(inofd, wd);
+}
+
+/* 캐시에서 빼고 캐시의 참조를 놓는다. fdc_mutex 를 잡고 부른다 */
+static void drop(fdc_file_t *f)
+{
+    fdc_file_t **pp;
+
+    for (pp = bucket(f->path); *pp != f; pp = &(*pp)->hnext)
+        ;
+    *pp = f->hnext;
+    if (f->prev)
+        f->prev->next = f->next;
+    else
+        lru_head = f->next;
+    if (f->next)
+        f->next->prev = f->prev;
+    else
+        lru_tail = f->prev;
+    count--;
+    bytes -= f->mem;
+    f->cached = 0;
+    unwatch(f->wd);
+    if (--f->refs == 0)
+        release(f);
+}
+
+/* 헤더를 만들고 작은 파일은 내용을 읽어 둔다. 실패하면 그 부분만 없이 둔다 */
+static void load(fdc_file_t *f)
+{
+    char buf[FDC_HEAD_MAX];
+    size_t size = f->st.st_size;
+    ssize_t n;
+
+    f->head = f->data = NULL;
+    f->headlen = f->mem = 0;
+    if (make_head && (n = make_head(f->path, &f->st, buf, sizeof(buf))) > 0 &&
+        (f->head = malloc(n)) != NULL) {
+        memcpy(f->head, buf, n);
+        f->headlen = n;
+        f->mem += n;
+    }
+    if (size > FDC_BODY_MAX || (f->data = malloc(size ? size : 1)) == NULL)
+        return;
+    /* 그 사이 파일이 바뀌어 크기가 다르면 올리지 않는다. inotify 가 곧 항목을 뺀다 */
+    if ((n = pread(f->fd, f->data, size, 0)) != (ssize_t)size) {
+        free(f->data);
+        f->data = NULL;
+        return;
+    }
+    f->mem += size;
+}
+
+int fdc_init(fdc_head_fn head)
+{
+    make_head = head;
+    inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return inofd;
+}
+
+void fdc_events(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    fdc_file_t *f, *next;
+    ssize_t n;
+    char *p;
+
+    while ((n = read(inofd, buf, sizeof(buf))) > 0) {
+        pthread_mutex_lock(&fdc_mutex);
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_IGNORED)
+                continue;
+            for (f = lru_head; f; f = next) {  /* 큐가 넘쳤으면(wd -1) 모두 버린다 */
+                next = f->next;
+                if (f->wd == ev->wd || ev->wd < 0)
+                    drop(f);
+            }
+        }
+        pthread_mutex_unlock(&fdc_mutex);
+    }
+}
+
+fdc_file_t *fdc_open(const char *path)
+{
+    fdc_file_t *f, *old, **pp;
+    int fd, wd = -1, err;
+    struct stat st;
+
+    pthread_mutex_lock(&fdc_mutex);
+    for (f = *bucket(path); f; f = f->hnext)
+        if (!strcmp(f->path, path))
+            break;
+    if (f && inofd < 0 && now_ms() - f->since > FDC_TTL_MS) {
+        drop(f);
+        f = NULL;
+    }
+    if (f) {
+        f->refs++;
+        if (f != lru_head) {  /* LRU 앞으로 */
+            f->prev->next = f->next;
+            if (f->next)
+                f->next->prev = f->prev;
+            else
+                lru_tail = f->prev;
+            f->prev = NULL;
+            f->next = lru_head;
+            lru_head->prev = f;
+            lru_head = f;
+        }
+        pthread_mutex_unlock(&fdc_mutex);
+        return f;
+    }
+    pthread_mutex_unlock(&fdc_mutex);
+
+    /* 없으면 락 밖에서 연다. watch 를 먼저 걸어야 여는 사이의 변경도 놓치지 않는다 */
+    if (inofd >= 0)
+        wd = inotify_add_watch(inofd, path, FDC_EVENTS);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0 ||
+        (!S_ISREG(st.st_mode) && (errno = EISDIR)) ||
+        (f = malloc(sizeof(fdc_file_t))) == NULL || (f->path = strdup(path)) == NULL) {
+        err = errno;
+        free(f);
+        if (fd >= 0)
+            close(fd);
+        pthread_mutex_lock(&fdc_mutex);
+        unwatch(wd);
+        pthread_mutex_unlock(&fdc_mutex);
+        errno = err;
+        return NULL;
+    }
+    f->fd = fd;
+    f->st = st;
+    f->wd = wd;
+    load(f);
+    f->refs = 2;  /* 캐시 + 호출자 */
+    f->since = now_ms();
+
+    pthread_mutex_lock(&fdc_mutex);
+    /* 그 사이 다른 스레드가 같은 경로를 넣었으면 그것을 바꾼다 */
+    for (old = *(pp = bucket(path)); old; old = old->hnext)
+        if (!strcmp(old->path, path))
+            break;
+    /*
+     * 빼거나 쫓아내기 전에 f 를 먼저 잇는다. 같은 inode(같은 경로, 하드 링크)면 watch 도 같아서,
+     * f 가 목록에 없으면 unwatch 가 방금 f 에 건 watch 를 떼 버린다
+     */
+    f->cached = 1;
+    f->hnext = *pp;
+    *pp = f;
+    f->prev = NULL;
+    f->next = lru_head;
+    if (lru_head)
+        lru_head->prev = f;
+    else
+        lru_tail = f;
+    lru_head = f;
+    count++;
+    bytes += f->mem;
+    if (old)
+        drop(old);
+    while (lru_tail != f && (count > FDC_MAX || bytes > FDC_MEM_MAX))
+        drop(lru_tail);
+    pthread_mutex_unlock(&fdc_mutex);
+    return f;
+}
+
+void fdc_close(fdc_file_t *f)
+{
+    int last;
+
+    pthread_mutex_lock(&fdc_mutex);
+    last = --f->refs == 0;
+    pthread_mutex_unlock(&fdc_mutex);
+    if (last)
+        release(f);
+}
+/* $end fdcache.c */
@@ -0,0 +1,59 @@
+/*
+ * fdcache.h - Cache of open file descriptors and stat results for tiny
+ *
+ * 정적 요청마다 stat, open, close 로 경로를 세 번 찾지 않도록 경로별로 열린 fd 와
+ * struct stat 을 들고 있는다. 파일이 바뀌면 inotify 가 알려 주고, 그 항목은 캐시에서
+ * 빠진다. 보내는 중인 요청은 참조를 들고 있으므로 fd 는 마지막 참조가 놓일 때 닫힌다.
+ * inotify 를 쓸 수 없으면 FDC_TTL_MS 가 지난 항목을 다시 연다.
+ * 항목을 만들 때 응답 헤더도 미리 만들어 두고, FDC_BODY_MAX 이하 파일은 내용까지 메모리에
+ * 올린다(모두 합쳐 FDC_MEM_MAX 까지). 그런 파일의 요청은 파일 시스템을 건드리지 않고
+ * 헤더와 내용을 writev 한 번으로 보낼 수 있다.
+ * 여러 스레드가 같이 써도 된다.
+ */
+/* $begin fdcache.h */
+#ifndef __FDCACHE_H__
+#define __FDCACHE_H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define FDC_MAX 256             /* 열어 두는 파일 수 */
+#define FDC_BUCKETS 512         /* 해시 버킷 수 (2의 거듭제곱) */
+#define FDC_TTL_MS 1000         /* inotify 가 없을 때 항목을 믿는 시간 */
+#define FDC_BODY_MAX 65536      /* 내용까지 메모리에 올리는 최대 파일 크기 */
+#define FDC_MEM_MAX (16 << 20)  /* 올려 둔 내용과 헤더의 총 바이트 */
+#define FDC_HEAD_MAX 512        /* 미리 만드는 응답 헤더의 최대 길이 */
+
+/* path 와 st 로 응답 헤더를 buf 에 만든다. 길이, 실패하면 0 */
+typedef size_t (*fdc_head_fn)(const char *path, const struct stat *st, char *buf, size_t size);
+
+typedef struct fdc_file {
+    int fd;                     /* 읽기 전용. pread/sendfile 처럼 파일 오프셋을 쓰지 않는 호출만 쓴다 */
+    struct stat st;
+    char *head;                 /* 미리 만든 응답 헤더, 없으면 NULL */
+    size_t headlen;
+    char *data;                 /* 파일 내용(st.st_size 바이트), 올리지 않았으면 NULL */
+    /* 아래는 캐시 내부 */
+    char *path;
+    int wd;                     /* inotify watch, 없으면 -1 */
+    int refs;                   /* 캐시가 하나, 빌려 간 요청마다 하나 */
+    int cached;                 /* 아직 캐시에 들어 있다 */
+    size_t mem;                 /* head + data 바이트 (FDC_MEM_MAX 에 센다) */
+    uint64_t since;             /* 연 시각 (ms, TTL 용) */
+    struct fdc_file *hnext, *prev, *next;
+} fdc_file_t;
+
+/*
+ * 항목마다 head 로 응답 헤더를 만든다. 이벤트 루프에 등록할 inotify fd 를 돌려준다.
+ * inotify 를 못 쓰면 -1 (TTL 로 대신한다)
+ */
+int fdc_init(fdc_head_fn head);
+/* inotify fd 가 읽을 수 있게 되면 부른다. 바뀐 파일의 항목을 뺀다 */
+void fdc_events(void);
+/* 일반 파일을 열어 참조를 하나 잡아 준다. 실패하면 NULL (errno, 일반 파일이 아니면 EISDIR) */
+fdc_file_t *fdc_open(const char *path);
+/* fdc_open 의 참조를 놓는다 */
+void fdc_close(fdc_file_t *f);
+
+#endif /* __FDCACHE_H__ */
+/* $end fdcache.h */
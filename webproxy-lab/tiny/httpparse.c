@@ -0,0 +1,170 @@
+/*
+ * httpparse.c - Incremental, zero-allocation HTTP/1.x request head parser
+ *
+ * 줄 단위 상태 기계다. 줄 끝을 찾은 위치(scan)를 기억하므로 요청이 잘게 나뉘어 와도
+ * 각 바이트는 줄 끝을 찾을 때 한 번, 그 줄을 나눌 때 한 번만 본다.
+ * 구분자 찾기와 token 검사는 scan.c 의 SIMD 커널로 한다.
+ * 요청 줄은 "method SP uri SP HTTP/1.x", 헤더는 "name: OWS value OWS" 만 받는다.
+ * 줄 접기(obs-fold)와 이름 뒤 공백은 요청 밀반입(smuggling)에 쓰이므로 오류로 본다.
+ */
+/* $begin httpparse.c */
+#include <string.h>
+#include <strings.h>
+#include "httpparse.h"
+#include "scan.h"
+
+enum { HP_START, HP_HEADERS, HP_END };
+
+void hp_init(hp_request_t *r, size_t max_head)
+{
+    r->method.p = r->uri.p = r->version.p = NULL;
+    r->method.len = r->uri.len = r->version.len = 0;
+    r->minor = 0;
+    r->nheaders = 0;
+    r->headlen = 0;
+    r->state = HP_START;
+    r->pos = r->scan = 0;
+    r->max_head = max_head > HP_MAX_HEAD ? HP_MAX_HEAD : max_head;
+}
+
+static int parse_request_line(hp_request_t *r, const char *line, size_t len)
+{
+    const char *sp1, *sp2, *end = line + len;
+    size_t n;
+
+    /* 메서드는 token 이고 바로 뒤가 공백이어야 한다 */
+    n = scan_token(line, len);
+    if (n == 0 || n == len || line[n] != ' ')
+        return HP_ERROR;
+    sp1 = line + n;
+    if ((sp2 = scan_chr(sp1 + 1, end - sp1 - 1, ' ')) == NULL || sp2 == sp1 + 1)
+        return HP_ERROR;
+    if (end - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7) ||
+        sp2[8] < '0' || sp2[8] > '9')
+        return HP_ERROR;
+
+    r->method.p = line;
+    r->method.len = sp1 - line;
+    r->uri.p = sp1 + 1;
+    r->uri.len = sp2 - sp1 - 1;
+    r->version.p = sp2 + 1;
+    r->version.len = 8;
+    r->minor = sp2[8] - '0';
+    return HP_AGAIN;
+}
+
+static int parse_header(hp_request_t *r, const char *line, size_t len)
+{
+    const char *colon, *v, *end = line + len;
+    hp_header_t *h;
+    size_t n;
+
+    /* 이름(token) 바로 뒤가 ':' 여야 한다. 접힌 줄, 이름 속/뒤 공백도 여기서 걸린다 */
+    n = scan_token(line, len);
+    if (n == 0 || n == len || line[n] != ':')
+        return HP_ERROR;
+    colon = line + n;
+    if (r->nheaders == HP_MAX_HEADERS)
+        return HP_TOOBIG;
+
+    for (v = colon + 1; v < end && (*v == ' ' || *v == '\t'); v++)
+        ;
+    while (end > v && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    h = &r->headers[r->nheaders++];
+    h->name.p = line;
+    h->name.len = colon - line;
+    h->value.p = v;
+    h->value.len = end - v;
+    return HP_AGAIN;
+}
+
+int hp_parse(hp_request_t *r, const char *buf, size_t len)
+{
+    const char *nl, *line;
+    size_t linelen;
+    int rc;
+
+    if (r->state == HP_END)
+        return HP_DONE;
+    while (1) {
+        nl = r->scan < len ? scan_chr(buf + r->scan, len - r->scan, '\n') : NULL;
+        if (nl == NULL) {
+            r->scan = len;
+            return len >= r->max_head ? HP_TOOBIG : HP_AGAIN;
+        }
+        if ((size_t)(nl - buf) >= r->max_head)
+            return HP_TOOBIG;
+
+        line = buf + r->pos;
+        linelen = nl - line;
+        if (linelen > 0 && line[linelen - 1] == '\r')
+            linelen--;
+        r->pos = r->scan = nl - buf + 1;
+
+        if (r->state == HP_START) {
+            if (linelen == 0)
+                continue;   /* 요청 앞의 빈 줄 */
+            if ((rc = parse_request_line(r, line, linelen)) != HP_AGAIN)
+                return rc;
+            r->state = HP_HEADERS;
+        }
+        else if (linelen == 0) {
+            r->state = HP_END;
+            r->headlen = r->pos;
+            return HP_DONE;
+        }
+        else if ((rc = parse_header(r, line, linelen)) != HP_AGAIN)
+            return rc;
+    }
+}
+
+static void rebase(hp_str_t *s, const char *oldbuf, const char *newbuf)
+{
+    if (s->p)
+        s->p = newbuf + (s->p - oldbuf);
+}
+
+void hp_rebase(hp_request_t *r, const char *oldbuf, const char *newbuf)
+{
+    int i;
+
+    if (oldbuf == newbuf)
+        return;
+    rebase(&r->method, oldbuf, newbuf);
+    rebase(&r->uri, oldbuf, newbuf);
+    rebase(&r->version, oldbuf, newbuf);
+    for (i = 0; i < r->nheaders; i++) {
+        rebase(&r->headers[i].name, oldbuf, newbuf);
+        rebase(&r->headers[i].value, oldbuf, newbuf);
+    }
+}
+
+void hp_terminate(hp_request_t *r)
+{
+    int i;
+
+    ((char *)r->method.p)[r->method.len] = '\0';
+    ((char *)r->uri.p)[r->uri.len] = '\0';
+    ((char *)r->version.p)[r->version.len] = '\0';
+    for (i = 0; i < r->nheaders; i++) {
+        ((char *)r->headers[i].name.p)[r->headers[i].name.len] = '\0';
+        ((char *)r->headers[i].value.p)[r->headers[i].value.len] = '\0';
+    }
+}
+
+int hp_streq(hp_str_t s, const char *lit)
+{
+    return strlen(lit) == s.len && !strncasecmp(s.p, lit, s.len);
+}
+
+const hp_str_t *hp_header(const hp_request_t *r, const char *name)
+{
+    int i;
+
+    for (i = 0; i < r->nheaders; i++)
+        if (hp_streq(r->headers[i].name, name))
+            return &r->headers[i].value;
+    return NULL;
+}
+/* $end httpparse.c */
@@ -0,0 +1,71 @@
+/*
+ * httpparse.h - Incremental, zero-allocation HTTP/1.x request head parser
+ *
+ * 수신 버퍼를 복사하지 않고 요청 줄과 각 헤더를 버퍼 안을 가리키는
+ * 문자열 뷰(포인터 + 길이)로 돌려준다. 요청이 여러 번의 read 에 걸쳐 와도
+ * 받은 만큼 다시 불러 주면 이어서 파싱한다.
+ * 버퍼가 옮겨지면(앞으로 당기기, 사본 만들기) hp_rebase 로 뷰를 따라 옮긴다.
+ */
+/* $begin httpparse.h */
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include <stddef.h>
+
+#define HP_MAX_HEADERS 64       /* 헤더 개수 제한 */
+#define HP_MAX_HEAD    8192     /* 요청 헤드(요청 줄 + 헤더 + 빈 줄) 길이 제한 */
+
+/* hp_parse 반환값 */
+#define HP_DONE     1           /* 헤드 끝(빈 줄)까지 파싱했다 */
+#define HP_AGAIN    0           /* 더 받아야 한다 */
+#define HP_ERROR   -1           /* 형식 오류 (400) */
+#define HP_TOOBIG  -2           /* 제한 초과 (431) */
+
+typedef struct {
+    const char *p;
+    size_t len;
+} hp_str_t;
+
+typedef struct {
+    hp_str_t name, value;
+} hp_header_t;
+
+typedef struct {
+    hp_str_t method, uri, version;
+    int minor;                  /* HTTP/1.x 의 x */
+    int nheaders;
+    hp_header_t headers[HP_MAX_HEADERS];
+    size_t headlen;             /* HP_DONE: 버퍼 앞에서부터 헤드가 차지한 바이트 */
+
+    /* 이어서 파싱하기 위한 상태 */
+    int state;
+    size_t pos;                 /* 아직 파싱하지 않은 줄의 시작 */
+    size_t scan;                /* 줄 끝('\n')을 찾기 시작할 위치 */
+    size_t max_head;
+} hp_request_t;
+
+void hp_init(hp_request_t *r, size_t max_head);
+
+/*
+ * buf[0..len) 은 이 요청의 첫 바이트부터 지금까지 받은 전부다.
+ * 이전 호출 이후 뒤에 덧붙은 바이트만 새로 본다. 요청 사이의 빈 줄은 건너뛴다.
+ */
+int hp_parse(hp_request_t *r, const char *buf, size_t len);
+
+/* 버퍼가 oldbuf 에서 newbuf 로 옮겨졌다: 모든 뷰를 따라 옮긴다 */
+void hp_rebase(hp_request_t *r, const char *oldbuf, const char *newbuf);
+
+/*
+ * 뷰마다 끝에 NUL 을 써서 C 문자열로도 쓸 수 있게 한다. 구분자(공백, CR, ':')를
+ * 덮어쓰므로 HP_DONE 이후, 고쳐도 되는 버퍼(사본 등)에서만 부를 것.
+ */
+void hp_terminate(hp_request_t *r);
+
+/* 대소문자를 무시하고 s 가 lit 과 같은가 */
+int hp_streq(hp_str_t s, const char *lit);
+
+/* 이름이 name 인 첫 헤더의 값, 없으면 NULL */
+const hp_str_t *hp_header(const hp_request_t *r, const char *name);
+
+#endif /* __HTTPPARSE_H__ */
+/* $end httpparse.h */
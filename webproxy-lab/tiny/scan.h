@@ -0,0 +1,31 @@
+/*
+ * scan.h - SIMD byte scanning kernels for the HTTP parsers
+ *
+ * 파서가 대부분의 시간을 쓰는 일은 구분자('\n', ' ', ':')를 찾는 것과
+ * 헤더 이름이 token 문자로만 되어 있는지 보는 것이다. 이 둘을 한 번에
+ * 16/32 바이트씩 처리한다. 실행 중에 CPU 를 보고 AVX2, SSE4.2, 스칼라 중
+ * 하나를 고른다. 어느 구현이든 결과는 같고, 버퍼 밖을 읽지 않는다.
+ */
+/* $begin scan.h */
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stddef.h>
+
+/* p[0..len) 에서 첫 c 의 위치, 없으면 NULL (memchr 와 같다) */
+const char *scan_chr(const char *p, size_t len, int c);
+
+/* p[0..len) 앞에서부터 RFC 7230 token 문자가 이어지는 길이 */
+size_t scan_token(const char *p, size_t len);
+
+/* 지금 쓰는 구현의 이름: "avx2", "sse4.2", "scalar" */
+const char *scan_impl(void);
+
+/*
+ * 구현을 이름으로 고른다(벤치마크용). CPU 가 지원하지 않거나
+ * 모르는 이름이면 -1 을 반환하고 바꾸지 않는다.
+ */
+int scan_use(const char *name);
+
+#endif /* __SCAN_H__ */
+/* $end scan.h */
@@ -0,0 +1,263 @@
+/*
+ * serve.c - Strategies for sending a static file after its response head
+ */
+/* $begin serve.c */
+#define _GNU_SOURCE  /* splice() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "serve.h"
+
+/* csapp.h 는 _GNU_SOURCE 와 같이 포함할 수 없어서(gai_error 가 겹친다) 쓰는 것만 선언한다 */
+ssize_t rio_writev_zc_nb(int fd, struct iovec **iovp, int *iovcntp, struct rio_zc *zp);
+
+/* 소켓이 더 받지 않는다 (O_NONBLOCK) */
+static int would_block(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void serve_sent(serve_job_t *job, size_t n)
+{
+    size_t h = n < job->hdr.iov_len ? n : job->hdr.iov_len;
+
+    job->hdr.iov_base = (char *)job->hdr.iov_base + h;
+    job->hdr.iov_len -= h;
+    job->off += n - h;
+    job->len -= n - h;
+}
+
+/*
+ * 남은 헤더와 body[0..bodylen) (파일의 job->off 부터의 내용) 을 writev 한다.
+ * 다 보냈으면 0, 막혔으면 1, 오류면 -1. 보낸 만큼 job 을 당긴다
+ */
+static int send_iov(int sockfd, serve_job_t *job, const char *body, size_t bodylen)
+{
+    struct iovec iov[2];
+    size_t h;
+    ssize_t n;
+
+    while (job->hdr.iov_len + bodylen > 0) {
+        iov[0] = job->hdr;
+        iov[1].iov_base = (void *)body;
+        iov[1].iov_len = bodylen;
+        if ((n = writev(sockfd, iov, 2)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return would_block() ? 1 : -1;
+        }
+        h = (size_t)n < job->hdr.iov_len ? (size_t)n : job->hdr.iov_len;
+        body += n - h;
+        bodylen -= n - h;
+        serve_sent(job, n);
+    }
+    return 0;
+}
+
+/*
+ * send_iov 와 같지만 rio_writev_zc_nb 로, 큰 본문은 페이지를 복사하지 않고 보낸다.
+ * 커널은 보낸 페이지를 완료 알림이 올 때까지 잡아 두므로 돌아온 뒤에 매핑을 풀어도 된다
+ * (읽기만 한 파일 매핑의 페이지는 페이지 캐시의 것이다). 알림은 호출자가 job->zc 로 거둔다
+ */
+static int send_zc(int sockfd, serve_job_t *job, const char *body)
+{
+    struct iovec iov[2], *iovp = iov;
+    int iovcnt = 2;
+    size_t total = job->hdr.iov_len + job->len;
+    ssize_t left;
+
+    iov[0] = job->hdr;
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = job->len;
+    if ((left = rio_writev_zc_nb(sockfd, &iovp, &iovcnt, job->zc)) < 0)
+        return -1;
+    serve_sent(job, total - left);
+    return left > 0;
+}
+
+/* 헤드를 MSG_MORE 로 보낸다: 커널이 뒤따르는 본문과 한 세그먼트로 묶는다 */
+static int send_head(int sockfd, serve_job_t *job)
+{
+    ssize_t n;
+
+    while (job->hdr.iov_len > 0) {
+        if ((n = send(sockfd, job->hdr.iov_base, job->hdr.iov_len, job->len > 0 ? MSG_MORE : 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return would_block() ? 1 : -1;
+        }
+        serve_sent(job, n);
+    }
+    return 0;
+}
+
+/*
+ * 작은 파일은 읽어서 헤드와 writev 한 번으로 보낸다. 시스템 콜이 하나 적어서
+ * 이 크기까지는 복사 한 번이 sendfile 보다 싸다 (servebench 기준 8KB 안팎에서 역전)
+ */
+static int serve_sendfile(int sockfd, serve_job_t *job)
+{
+    char small[SERVE_SMALL];
+    ssize_t n;
+    int rc;
+
+    if (job->len <= SERVE_SMALL) {
+        while ((n = pread(job->filefd, small, job->len, job->off)) < 0 && errno == EINTR)
+            ;
+        if (n == (ssize_t)job->len)
+            return send_iov(sockfd, job, small, n);
+        if (n < 0)
+            return -1;
+    }
+    if ((rc = send_head(sockfd, job)) != 0)
+        return rc;
+    while (job->len > 0) {
+        if ((n = sendfile(sockfd, job->filefd, &job->off, job->len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return would_block() ? 1 : -1;
+        }
+        if (n == 0) {           /* 파일이 그 사이 줄었다 */
+            errno = EIO;
+            return -1;
+        }
+        job->len -= n;
+    }
+    return 0;
+}
+
+/*
+ * 소켓이 받지 않아 파이프에 남은 n 바이트를 버린다. 보내지 않은 바이트라 job 은 당기지 않았으니
+ * 다음 호출이 파일에서 다시 옮긴다. 파이프를 비우지 못하면 닫아서 다음 호출이 새로 만들게 한다
+ */
+static void pipe_discard(int pfd[2], size_t n)
+{
+    char junk[SERVE_SMALL];
+    ssize_t m;
+    int err = errno;
+
+    while (n > 0) {
+        if ((m = read(pfd[0], junk, n < sizeof(junk) ? n : sizeof(junk))) <= 0) {
+            if (m < 0 && errno == EINTR)
+                continue;
+            close(pfd[0]);
+            close(pfd[1]);
+            pfd[0] = pfd[1] = -1;
+            break;
+        }
+        n -= m;
+    }
+    errno = err;
+}
+
+static int serve_splice(int sockfd, serve_job_t *job)
+{
+    static __thread int pfd[2] = {-1, -1};  /* 스레드마다 하나를 계속 쓴다. 돌아올 때는 늘 비어 있다 */
+    loff_t off;
+    ssize_t n, m;
+    int more, rc;
+
+    if (pfd[0] < 0 && pipe(pfd) < 0)
+        return -1;
+    if ((rc = send_head(sockfd, job)) != 0)
+        return rc;
+    while (job->len > 0) {
+        off = job->off;
+        n = splice(job->filefd, &off, pfd[1], NULL, job->len < SERVE_BUFSIZE ? job->len : SERVE_BUFSIZE,
+                   SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        more = job->len > (size_t)n ? SPLICE_F_MORE : 0;
+        while (n > 0) {
+            if ((m = splice(pfd[0], NULL, sockfd, NULL, n, SPLICE_F_MOVE | more)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                rc = would_block() ? 1 : -1;
+                pipe_discard(pfd, n);
+                return rc;
+            }
+            n -= m;
+            job->off += m;
+            job->len -= m;
+        }
+    }
+    return 0;
+}
+
+/*
+ * 부를 때마다 남은 구간을 매핑한다. 막혀서 다시 불리면 그 자리부터 다시 매핑한다.
+ * job->zc 가 있으면 매핑한 페이지를 복사 없이(MSG_ZEROCOPY) 보낸다
+ */
+static int serve_mmap(int sockfd, serve_job_t *job)
+{
+    size_t skew = job->off % sysconf(_SC_PAGESIZE);  /* 매핑은 페이지 경계에서 시작해야 한다 */
+    size_t maplen = skew + job->len;
+    char *p = NULL;
+    int rc;
+
+    if (job->len > 0 && (p = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, job->filefd, job->off - skew)) == MAP_FAILED)
+        return -1;
+    if (job->zc)
+        rc = send_zc(sockfd, job, p ? p + skew : NULL);
+    else
+        rc = send_iov(sockfd, job, p ? p + skew : NULL, job->len);
+    if (p)
+        munmap(p, maplen);
+    return rc;
+}
+
+/* 덩어리마다 읽어서 보낸다. 덩어리 도중 막히면 다음 호출이 나머지를 다시 읽는다 */
+static int serve_read(int sockfd, serve_job_t *job)
+{
+    char *buf;
+    ssize_t n;
+    int rc = 0;
+
+    if ((buf = malloc(SERVE_BUFSIZE)) == NULL)
+        return -1;
+    do {  /* 첫 덩어리는 헤드와 함께 */
+        n = 0;
+        if (job->len > 0 &&
+            (n = pread(job->filefd, buf, job->len < SERVE_BUFSIZE ? job->len : SERVE_BUFSIZE, job->off)) <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0)
+                errno = EIO;
+            free(buf);
+            return -1;
+        }
+        rc = send_iov(sockfd, job, buf, n);
+    } while (rc == 0 && job->len > 0);
+    free(buf);
+    return rc;
+}
+
+const serve_strategy_t serve_strategies[] = {
+    {"sendfile", serve_sendfile},
+    {"splice", serve_splice},
+    {"mmap", serve_mmap},
+    {"read", serve_read},
+    {NULL, NULL}
+};
+
+const serve_strategy_t *serve_find(const char *name)
+{
+    const serve_strategy_t *s;
+
+    for (s = serve_strategies; s->name; s++)
+        if (!strcmp(s->name, name))
+            return s;
+    return NULL;
+}
+/* $end serve.c */
@@ -0,0 +1,62 @@
+/*
+ * serve.h - Strategies for sending a static file after its response head
+ *
+ * 정적 파일 본문을 소켓으로 보내는 방법을 시작할 때 고를 수 있게 한다.
+ *   sendfile  페이지 캐시에서 소켓으로 바로 (유저 공간 복사 없음)
+ *   splice    파일 -> 파이프 -> 소켓 (유저 공간 복사 없음)
+ *   mmap      매핑한 파일을 writev (유저->커널 복사 1회)
+ *   read      버퍼로 읽어 write (커널->유저, 유저->커널 복사 2회)
+ * 어느 쪽이든 헤드와 본문 앞부분이 한 패킷으로 나가도록 헤드를 붙여 보낸다(writev 또는 MSG_MORE).
+ * 소켓이 O_NONBLOCK 이면 받는 만큼만 보내고 돌아오며, 나머지는 같은 job 으로 다시 불러 이어 보낸다.
+ * bench/servebench 로 재 보면 8KB 를 넘는 파일은 sendfile 이 가장 빠르고 CPU 도 가장 적게 쓰며,
+ * 그보다 작은 파일은 read + writev 한 번이 낫다. 그래서 기본값 sendfile 은 작은 파일을 그렇게 보낸다.
+ */
+/* $begin serve.h */
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define SERVE_DEFAULT "sendfile"
+#define SERVE_BUFSIZE 65536     /* read 전략의 버퍼, splice 한 번에 옮기는 최대 바이트 */
+#define SERVE_SMALL 8192        /* sendfile 전략이 sendfile 대신 헤드와 같이 writev 하는 최대 파일 크기 */
+
+/*
+ * 응답 하나에서 아직 보내지 않은 부분: 헤더 바이트 hdr 다음에 filefd 의 [off, off+len).
+ * 보낸 만큼 hdr 과 off, len 을 당겨 두므로 소켓이 막혀 돌아와도 그 자리에서 이어 보낼 수 있다.
+ * filefd 의 파일 오프셋은 건드리지 않으므로 여러 요청이 같은 fd 를 동시에 써도 된다
+ */
+struct rio_zc;                  /* csapp.h 의 rio_zc_t */
+
+typedef struct {
+    struct iovec hdr;
+    int filefd;
+    off_t off;
+    size_t len;
+    struct rio_zc *zc;          /* 소켓의 zero-copy 상태. 있으면 mmap 전략이 복사 없이 보낸다 (NULL 이면 복사) */
+} serve_job_t;
+
+/*
+ * sockfd 로 job 을 보낼 수 있는 만큼 보낸다. 다 보냈으면 0, 소켓(O_NONBLOCK)이 더 받지 않으면 1
+ * (쓸 수 있게 되면 같은 job 으로 다시 부른다), 오류면 -1 (errno). zc 가 없고 블로킹 소켓이면 0 아니면 -1
+ */
+typedef int (*serve_fn)(int sockfd, serve_job_t *job);
+
+typedef struct {
+    const char *name;
+    serve_fn send;
+} serve_strategy_t;
+
+/* 이름 순서대로, 끝은 name 이 NULL */
+extern const serve_strategy_t serve_strategies[];
+
+/* 이름으로 찾는다. 없으면 NULL */
+const serve_strategy_t *serve_find(const char *name);
+
+/* job 에서 n 바이트가 나갔다: 헤더부터, 그다음 파일 구간을 당긴다 */
+void serve_sent(serve_job_t *job, size_t n);
+
+#endif /* __SERVE_H__ */
+/* $end serve.h */
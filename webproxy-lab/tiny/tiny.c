@@ -1,70 +1,365 @@
 /* $begin tinymain */
 /*
- * tiny.c - A simple, iterative HTTP/1.0 Web server that uses the
+ * tiny.c - A simple, iterative HTTP/1.1 Web server that uses the
  *     GET method to serve static and dynamic content.
  *
  * Updated 11/2019 droh
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
  */
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
+#include "timer.h"
+#include "httpparse.h"
+#include "serve.h"
+#include "fdcache.h"
+
+#define MAXEVENTS 64
+#define TICK_MS 100                /* 타이밍 휠 해상도 */
+#define REQUEST_TIMEOUT_MS 10000   /* 요청 헤드가 다 도착해야 하는 시간 */
+#define IDLE_TIMEOUT_MS 15000      /* 지속 연결에서 응답 후 다음 요청을 기다리는 시간 */
+#define WRITE_TIMEOUT_MS 15000     /* 막힌 소켓이 응답을 더 받아 가지 않고 버틸 수 있는 시간 */
+#define RANGE_MAX 16               /* Range 헤더 하나에서 받아 주는 구간 수. 넘으면 전체를 보낸다 */
+#define OUT_JOBS (RANGE_MAX + 1)   /* 응답 하나의 조각 수: multipart 의 파트마다 하나 + 닫는 경계 */
 
-void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+/*
+ * 요청을 기다리는 연결. 이벤트 루프(epoll)와 타이밍 휠에 함께 등록된다.
+ * 헤드가 여러 번에 나눠 도착하면 받은 바이트는 rio 에, 파싱 상태는 hp 에 남아 다음 이벤트에서 이어진다.
+ * 응답은 out/job 에 쌓았다가 소켓이 받는 만큼 보내고, 막히면 남은 조각을 두고 EPOLLOUT 을 기다린다
+ */
+typedef struct {
+  int fd;
+  tw_timer_t timer;
+  rio_t rio;
+  hp_request_t hp;
+  rio_writer_t out;           /* 응답이 만든 바이트: 응답 헤더, 파트 헤더, 에러 페이지 */
+  serve_job_t job[OUT_JOBS];  /* 보낼 조각을 순서대로: out 안의 헤더 바이트 다음에 파일 구간 */
+  int njob, cur;              /* 쌓인 조각 수와 지금 보내는 조각 */
+  fdc_file_t *file;           /* 조각들이 읽는 파일. 다 보낼 때까지 참조를 잡아 둔다 */
+  int keep;                   /* 응답을 다 보낸 뒤 연결을 유지한다 */
+  int writing;                /* EPOLLIN 대신 EPOLLOUT 을 기다리는 중 */
+  rio_zc_t zc;                /* mmap 전략이 복사 없이 보낸 것. 완료 알림은 EPOLLERR 로 온다 */
+} conn_t;
+
+/* Range 요청의 한 구간 (파일 안의 오프셋과 길이) */
+typedef struct {
+  off_t off;
+  off_t len;
+} byterange_t;
+
+static int epfd;
+static tw_wheel_t wheel;
+static const serve_strategy_t *serve;  /* 정적 파일 본문을 보내는 방법 (시작할 때 고른다) */
+static int inofd;  /* 열어 둔 파일이 바뀌었다는 inotify 알림. 없으면 -1 */
+
+static void accept_conn(int listenfd);
+static void conn_ready(conn_t *c);
+static int conn_flush(conn_t *c);
+static void conn_watch(conn_t *c, int writing);
+static void conn_close(conn_t *c);
+static void conn_timeout(tw_timer_t *t, void *arg);
+static void out_add(conn_t *c, const char *hdr, size_t hdrlen, off_t off, size_t len);
+static void out_reset(conn_t *c);
+
+int doit(conn_t *c);
+int read_request(conn_t *c);
+static int keep_alive(const hp_request_t *hp);
+static int has_token(const char *value, const char *token);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize, int is_haed);
+int serve_static(conn_t *c, char *filename, fdc_file_t *f, int is_haed, int keep);
+static int serve_ranges(conn_t *c, char *filename, fdc_file_t *f, const byterange_t *r, int n, int keep);
+static int parse_ranges(const char *spec, off_t size, byterange_t *r, int max);
+static int if_range_ok(const hp_request_t *hp, const struct stat *st);
 void get_filetype(char *filename, char *filetype);
+static void validators(const struct stat *st, char *date, size_t datesize, char *etag, size_t etagsize);
+static size_t static_head(const char *filename, const struct stat *st, char *buf, size_t size);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg,
+void clienterror(conn_t *c, int keep, char *cause, char *errnum, char *shortmsg,
                  char *longmsg);
 
-/* main -> accep 루프 -> doit -> (read_requesthdrs, parse_uri) -> serve_static | serve_dynamic -> close */
+/* 응답 헤더의 마지막 줄. 연결을 유지할지 알린다 */
+static const char keep_hdr[] = "Connection: keep-alive\r\n\r\n";
+static const char close_hdr[] = "Connection: close\r\n\r\n";
+
+/* main -> epoll 루프 -> (accept | read_request -> doit -> parse_uri -> serve_static | serve_dynamic -> conn_flush -> 다음 요청 또는 close) */
 int main(int argc, char **argv)
 {
-  int listenfd, connfd;
-  char hostname[MAXLINE], port[MAXLINE];
-  socklen_t clientlen;
-  struct sockaddr_storage clientaddr;
+  int listenfd, i, n;
+  struct epoll_event ev, events[MAXEVENTS];
 
-  /* 포트 미지정시 종료 */
-  if (argc != 2)
+  /* 포트 미지정시 종료. 두 번째 인자로 정적 파일 전송 방법을 고른다 */
+  if (argc != 2 && argc != 3)
   {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    fprintf(stderr, "usage: %s <port> [sendfile|splice|mmap|read]\n", argv[0]);
     exit(1);
   }
+  if ((serve = serve_find(argc == 3 ? argv[2] : SERVE_DEFAULT)) == NULL) {
+    fprintf(stderr, "%s: unknown serving strategy %s\n", argv[0], argv[2]);
+    exit(1);
+  }
+  Signal(SIGPIPE, SIG_IGN);  // 응답 도중 클라이언트가 끊어도 서버는 계속 돈다
 
   /* 리스닝 소켓 생성. socket -> setsockopt(SO_REUSEADDR) -> bind -> listen */
   listenfd = Open_listenfd(argv[1]);
 
-  /* 무한 accept 루프 */
+  /* 리스닝 소켓을 epoll에 등록. data.ptr == NULL 이면 리스닝 소켓 */
+  if ((epfd = epoll_create1(0)) < 0)
+    unix_error("epoll_create1 error");
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+    unix_error("epoll_ctl error");
+  /* 정적 파일의 fd/stat 캐시. 파일이 바뀌면 inotify 가 루프를 깨운다 */
+  if ((inofd = fdc_init(static_head)) >= 0) {
+    ev.data.ptr = &inofd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, inofd, &ev) < 0)
+      unix_error("epoll_ctl error");
+  }
+  tw_init(&wheel, TICK_MS, tw_now_ms());
+
+  /* 이벤트 루프. 대기 시간은 타이밍 휠의 다음 만료 시점이 정한다 */
   while (1)
   {
-    clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr,
-                    &clientlen); // TCP 3-way handshake 완료된 연결 소켓 획득. (커널이 listen 큐에서 꺼냄)
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0); // 클라이언트 호스트/서비스 문자열 획득
+    n = epoll_wait(epfd, events, MAXEVENTS, tw_next_timeout(&wheel, tw_now_ms()));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      unix_error("epoll_wait error");
+    }
+    for (i = 0; i < n; i++)  // 파일 변경 알림부터: 같은 묶음에 온 요청이 바뀌기 전 내용을 받지 않게
+      if (events[i].data.ptr == &inofd)
+        fdc_events();
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_conn(listenfd);
+      else if (events[i].data.ptr != &inofd)
+        conn_ready(events[i].data.ptr);
+    }
+    tw_advance(&wheel, tw_now_ms()); // 만료된 타이머를 tick 단위로 몰아서 처리
+  }
+}
 
-    printf("Accepted connection from (%s, %s)\n", hostname, port);
-    doit(connfd);  // HTTP 트랜잭션 1건 처리.
-    Close(connfd); // 연결 종료(HTTP/1.0 단발).
+/* 새 연결을 받아 요청이 올 때까지 루프에 맡긴다 */
+static void accept_conn(int listenfd)
+{
+  char hostname[MAXLINE], port[MAXLINE];
+  socklen_t clientlen;
+  struct sockaddr_storage clientaddr;
+  struct epoll_event ev;
+  conn_t *c;
+  int connfd, one = 1;
+
+  clientlen = sizeof(clientaddr);
+  connfd = accept(listenfd, (SA *)&clientaddr, &clientlen); // TCP 3-way handshake 완료된 연결 소켓 획득. (커널이 listen 큐에서 꺼냄)
+  if (connfd < 0) { /* EMFILE 등: 서버를 죽이지 않고 다음 이벤트로 */
+    fprintf(stderr, "accept error: %s\n", strerror(errno));
+    return;
+  }
+  // 클라이언트 주소/포트 문자열. 숫자로만: 역방향 조회는 연결마다 /etc/hosts 나 DNS 를 뒤진다
+  Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE,
+              NI_NUMERICHOST | NI_NUMERICSERV);
+  printf("Accepted connection from (%s, %s)\n", hostname, port);
+
+  // 지속 연결에서 연달아 나가는 작은 응답이 Nagle 에 묶여 지연 ACK 를 기다리지 않게
+  setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  // 응답을 보내다 소켓이 차도 루프가 멈추지 않게. 못 보낸 나머지는 EPOLLOUT 에서 이어 보낸다
+  fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+  c = Malloc(sizeof(conn_t));
+  c->fd = connfd;
+  tw_timer_init(&c->timer, conn_timeout, c);
+  Rio_readinitb(&c->rio, connfd);  // 내부 버퍼는 첫 읽기 때 할당된다
+  hp_init(&c->hp, HP_MAX_HEAD);
+  rio_writeinitb(&c->out, connfd);
+  c->njob = c->cur = 0;
+  c->file = NULL;
+  c->keep = 1;
+  c->writing = 0;
+  rio_zcinit(&c->zc);
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+    Close(connfd);
+    Free(c);
+    return;
+  }
+  tw_add(&wheel, &c->timer, REQUEST_TIMEOUT_MS);
+}
+
+/*
+ * 요청 데이터가 도착했거나(EPOLLIN) 막혔던 소켓이 다시 쓸 수 있게 된(EPOLLOUT) 연결.
+ * 도착한 만큼만 막지 않고 읽어 두고, 헤드가 다 모일 때마다 트랜잭션 1건 처리.
+ * 헤드를 조금씩 보내는 클라이언트가 루프를 붙잡지 못한다. 응답도 소켓이 받는 만큼만 보내고,
+ * 다 나가기 전에는 다음 요청을 읽지 않는다. 응답을 천천히 받아 가는 클라이언트도 루프를 붙잡지 못한다.
+ * 지속 연결은 같은 rio 버퍼로 다음 요청을 받는다. 파이프라인된 요청은 이미 버퍼에
+ * 와 있으므로 다시 기다리지 않고 순서대로 이어서 처리한다(응답도 그 순서로 나간다).
+ */
+static void conn_ready(conn_t *c)
+{
+  int rc, served = 0;
+
+  // zero-copy 완료 알림을 거둔다. 에러 큐에 남아 있으면 EPOLLERR 가 계속 깨운다
+  if (c->zc.rio_zc_pending > 0 && rio_zc_reap_nb(c->fd, &c->zc) < 0) {
+    tw_del(&wheel, &c->timer);
+    conn_close(c);
+    return;
   }
+  while (1) {
+    if (c->njob > 0) {  // 쌓인 응답부터 보낸다
+      if ((rc = conn_flush(c)) > 0) {  // 소켓이 찼다: 쓸 수 있게 되면 이어 보낸다
+        conn_watch(c, 1);
+        tw_del(&wheel, &c->timer);
+        tw_add(&wheel, &c->timer, WRITE_TIMEOUT_MS);
+        return;
+      }
+      out_reset(c);
+      conn_watch(c, 0);
+      if (rc < 0)
+        break;
+      served = 1;
+    }
+    if (!c->keep)  // 이 응답 뒤에 닫는다
+      break;
+    if ((rc = read_request(c)) < 0) {
+      // 헤드가 덜 왔다. 다음 EPOLLIN 에서 이어 읽는다. 응답을 보냈으면 기한을 새로 건다:
+      // 받다 만 다음 요청이 있으면 요청 시간, 없으면 유휴 시간
+      if (served) {
+        tw_del(&wheel, &c->timer);
+        tw_add(&wheel, &c->timer, c->rio.rio_cnt > 0 ? REQUEST_TIMEOUT_MS : IDLE_TIMEOUT_MS);
+      }
+      return;
+    }
+    if (rc == 0 && c->njob == 0)
+      break;  // EOF 또는 읽기 오류
+    if (rc > 0) {
+      c->keep = doit(c);  // HTTP 트랜잭션 1건 처리. 0 이면 이 응답 뒤에 닫는다
+      hp_init(&c->hp, HP_MAX_HEAD);
+    }
+  }
+  tw_del(&wheel, &c->timer);
+  conn_close(c);
 }
 
-/* 한 개의 HTTP 트랜잭션을 처리한다. */
-void doit(int fd)
+/*
+ * 쌓인 조각을 소켓이 받는 만큼 보낸다. 다 보냈으면 0, 소켓이 막혔으면 1, 오류면 -1.
+ * 헤더와 메모리에 올린 파일은 rio_writev_nb 로, 디스크의 파일 구간은 serve 전략으로 보낸다.
+ * 어느 쪽이든 보낸 만큼 조각을 당겨 두므로 다음 호출이 그 자리에서 이어 간다
+ */
+static int conn_flush(conn_t *c)
 {
+  serve_job_t *j;
+  struct iovec iov[2], *iovp;
+  int iovcnt, rc;
+  ssize_t left;
+  size_t total;
+
+  for (; c->cur < c->njob; c->cur++) {
+    j = &c->job[c->cur];
+    if (j->len > 0 && c->file->data == NULL) {
+      if ((rc = serve->send(c->fd, j)) < 0)
+        fprintf(stderr, "%s error: %s\n", serve->name, strerror(errno));  // 보통 클라이언트가 먼저 끊었다
+      if (rc != 0)
+        return rc;
+      continue;
+    }
+    iov[0] = j->hdr;
+    iov[1].iov_base = j->len > 0 ? c->file->data + j->off : NULL;
+    iov[1].iov_len = j->len;
+    iovp = iov;
+    iovcnt = 2;
+    total = j->hdr.iov_len + j->len;
+    if ((left = rio_writev_nb(c->fd, &iovp, &iovcnt)) < 0) {
+      fprintf(stderr, "writev error: %s\n", strerror(errno));
+      return -1;
+    }
+    if (left > 0) {
+      serve_sent(j, total - left);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* 소켓이 막혔으면 EPOLLOUT 을, 다 보냈으면 다시 EPOLLIN 을 기다린다 */
+static void conn_watch(conn_t *c, int writing)
+{
+  struct epoll_event ev;
+
+  if (c->writing == writing)
+    return;
+  ev.events = writing ? EPOLLOUT : EPOLLIN;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+    fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+  c->writing = writing;
+}
+
+/*
+ * 응답 조각 하나를 쌓는다: out 안의 헤더 바이트 hdr 다음에 c->file 의 [off, off+len).
+ * hdr 은 out 을 다 채운 뒤에 가리켜야 한다 (out 이 자라면 버퍼가 옮겨진다)
+ */
+static void out_add(conn_t *c, const char *hdr, size_t hdrlen, off_t off, size_t len)
+{
+  serve_job_t *j = &c->job[c->njob++];
+
+  j->hdr.iov_base = (void *)hdr;
+  j->hdr.iov_len = hdrlen;
+  j->filefd = c->file ? c->file->fd : -1;
+  j->off = off;
+  j->len = len;
+  j->zc = &c->zc;
+}
+
+/* 다 보낸(또는 버리는) 응답을 치운다. out 의 버퍼는 다음 응답이 다시 쓴다 */
+static void out_reset(conn_t *c)
+{
+  if (c->file) {
+    fdc_close(c->file);
+    c->file = NULL;
+  }
+  c->out.rio_len = 0;
+  c->njob = c->cur = 0;
+}
+
+/* 소켓과 rio 버퍼, 보내다 만 응답을 정리한다 */
+static void conn_close(conn_t *c)
+{
+  Close(c->fd); // 마지막 참조가 닫히면 epoll 등록도 자동 해제
+  rio_freeb(&c->rio);
+  out_reset(c);
+  rio_writefreeb(&c->out);
+  Free(c);
+}
+
+/*
+ * 제한 시간 안에 요청을 보내지 않은 연결(slowloris 등), 오래 논 지속 연결,
+ * 응답을 받아 가지 않는 연결은 끊는다
+ */
+static void conn_timeout(tw_timer_t *t, void *arg)
+{
+  conn_t *c = arg;
+
+  printf("%s timeout on fd %d\n", c->writing ? "Write" : "Request", c->fd);
+  conn_close(c);
+}
+
+/*
+ * 한 개의 HTTP 트랜잭션을 처리한다. hp 는 read_request 가 끝까지 파싱한 요청 헤드.
+ * 연결을 유지해도 되면 1, 이 응답 뒤에 닫아야 하면 0
+ */
+int doit(conn_t *c)
+{
+  hp_request_t *hp = &c->hp;
+  int fd = c->fd;
   int is_static; // 정적, 동적 구분
   struct stat sbuf; // 파일 메타
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE]; // 요청 라인 파싱 버퍼
+  char *method, *uri; // 요청 라인의 메서드/URI (rio 버퍼 안을 가리킨다)
   char filename[MAXLINE], cgiargs[MAXLINE]; // 서비스 대상 경로, CGI 인자
-  rio_t rio;
+  fdc_file_t *f; // 정적 파일의 열린 fd 와 stat
   int is_head;
+  int keep = keep_alive(hp);
 
-  /* Read request line and headers */
-  Rio_readinitb(&rio, fd);            // fd로 rio 버퍼 초기화
-  Rio_readlineb(&rio, buf, MAXLINE);  // 요청 라인 한 줄
-  printf("Request headers:\n");
-  printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version); // 메서드/URI/버전 추출 -> "GET /path HTTP/1.1"
+  method = (char *)hp->method.p;
+  uri = (char *)hp->uri.p;
 
   /* 메서드 체크(GET, HEAD 외 501) */
   if (!strcasecmp(method, "GET")) {
@@ -74,76 +369,149 @@ void doit(int fd)
     is_head = 1;
   } 
   else {
-    clienterror(fd, method, "501", "Not implemented", "Tiny does not implement this method");
-    return;
+    clienterror(c, keep, method, "501", "Not implemented", "Tiny does not implement this method");
+    return keep;
   }
 
-  read_requesthdrs(&rio);
-  
   /* Parse URI from GET request */
   is_static = parse_uri(uri, filename, cgiargs);
 
-  /* stat(2)로 파일 상태 확인. 실패 시 404 */
-  if (stat(filename, &sbuf) < 0) {
-    clienterror(fd, filename, "404", "Not found", "Tiny couldn't find this file");
-    return;
-  }
-  
   if (is_static) { /* Serve static content */
-    if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
-      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't read this file");
-      return;
+    /* 열린 fd 와 stat 을 캐시에서 빌린다. 캐시에 있으면 경로를 다시 찾지 않는다 */
+    if ((f = fdc_open(filename)) == NULL) {
+      if (errno == ENOENT || errno == ENOTDIR)
+        clienterror(c, keep, filename, "404", "Not found", "Tiny couldn't find this file");
+      else
+        clienterror(c, keep, filename, "403", "Forbidden", "Tiny couldn't read this file");
+      return keep;
     }
-    serve_static(fd, filename, sbuf.st_size, is_head);
-  }
-  else { /* Serve dynamic content */
-    if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
-      clienterror(fd, filename, "403", "Forbidden", "Tiny couldn't run the CGI program");
-      return;
+    if (!(S_IRUSR & f->st.st_mode)) {
+      clienterror(c, keep, filename, "403", "Forbidden", "Tiny couldn't read this file");
+      fdc_close(f);
+      return keep;
     }
+    c->file = f;  // 응답을 다 보낼 때까지 연결이 참조를 잡는다
+    return serve_static(c, filename, f, is_head, keep);
+  }
 
-    if (is_head) { /* 동적 HEAD는 미지원 */
-      clienterror(fd, method, "501", "Not implemented", "HEAD for CGI is not supported");
-      return;
-    }
+  /* stat(2)로 파일 상태 확인. 실패 시 404 */
+  if (stat(filename, &sbuf) < 0) {
+    clienterror(c, keep, filename, "404", "Not found", "Tiny couldn't find this file");
+    return keep;
+  }
+  /* Serve dynamic content */
+  if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
+    clienterror(c, keep, filename, "403", "Forbidden", "Tiny couldn't run the CGI program");
+    return keep;
+  }
 
-    serve_dynamic(fd, filename, cgiargs);
+  if (is_head) { /* 동적 HEAD는 미지원 */
+    clienterror(c, keep, method, "501", "Not implemented", "HEAD for CGI is not supported");
+    return keep;
   }
+
+  serve_dynamic(fd, filename, cgiargs);
+  return 0;  // CGI 는 본문 길이를 알리지 않을 수 있으니 닫아서 끝을 알린다
 }
 
-/* 에러 메시지를 클라이언트에게 보낸다. */
-void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
+/* 에러 메시지를 클라이언트에게 보낸다(연결의 응답으로 쌓는다). keep 이면 연결을 유지한다고 알린다 */
+void clienterror(conn_t *c, int keep, char *cause, char *errnum, char *shortmsg, char *longmsg)
+{
+  rio_writer_t body;
+
+  /* Build the HTTP response body: 출력 버퍼에 한 번에 이어 쓴다(긴 cause 도 잘리지 않는다) */
+  rio_writeinitb(&body, c->fd);
+  Rio_printfb(&body, "<html><title>Tiny Error</title>"
+                     "<body bgcolor=""ffffff"">\r\n"
+                     "%s: %s\r\n"
+                     "<p>%s: %s\r\n"
+                     "<hr><em>The Tiny Web server</em>\r\n",
+              errnum, shortmsg, longmsg, cause);
+
+  /* Print the HTTP response: 헤더와 본문을 조각 하나로 */
+  Rio_printfb(&c->out, "HTTP/1.1 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n%s",
+              errnum, shortmsg, (int)body.rio_len, keep ? keep_hdr : close_hdr);
+  Rio_writeb(&c->out, body.rio_buf, body.rio_len);
+  out_add(c, c->out.rio_buf, c->out.rio_len, 0, 0);
+  rio_writefreeb(&body);
+}
+
+/*
+ * 요청 줄과 헤더를 rio 버퍼 위에서 바로 파싱한다. 복사하지 않고 뷰만 잡는다.
+ * 소켓에서 막지 않고 읽을 수 있는 만큼 버퍼를 채운다. 헤드가 아직 덜 왔으면 -1:
+ * 받은 바이트와 파싱 상태(hp_init 한 hp)가 그대로 남아 다음 호출이 이어간다. 헤더 값은 쓰지 않는다.
+ * 성공하면 뷰를 NUL 로 끝맺고 1, EOF·형식 오류·제한 초과는 0 (오류면 에러 응답을 쌓고 keep 을 끈다)
+ */
+int read_request(conn_t *c)
 {
-  char buf[MAXLINE], body[MAXBUF];
-
-  /* Build the HTTP response body */
-  sprintf(body, "<html><title>Tiny Error</title>");
-  sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-  sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
-
-  /* Print the HTTP response */
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  rio_t *rp = &c->rio;
+  hp_request_t *hp = &c->hp;
+  char *old;
+  ssize_t n;
+  int rc;
+
+  while ((rc = hp_parse(hp, rp->rio_bufptr, rp->rio_cnt)) == HP_AGAIN) {
+    old = rp->rio_bufptr;
+    n = rio_fillb_nb(rp);
+    hp_rebase(hp, old, rp->rio_bufptr);  // EAGAIN 이어도 버퍼는 옮겨졌을 수 있다
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return -1;
+    if (n <= 0)
+      return 0;  // 헤드 도중 EOF 또는 오류
+  }
+  if (rc == HP_TOOBIG) {
+    c->keep = 0;
+    clienterror(c, 0, "request", "431", "Request Header Fields Too Large", "Tiny limits the request head size");
+    return 0;
+  }
+  if (rc != HP_DONE) {
+    c->keep = 0;
+    clienterror(c, 0, "request", "400", "Bad Request", "Tiny couldn't parse the request");
+    return 0;
+  }
+  printf("Request headers:\n");
+  printf("%.*s", (int)hp->headlen, rp->rio_bufptr);
+  hp_terminate(hp);
+  rio_consumeb(rp, hp->headlen);
+  return 1;
 }
 
-/* 요청 헤더를 읽고 무시한다. (Host, User-Agent, Content-Length 등) */
-void read_requesthdrs(rio_t *rp)
+/*
+ * HTTP/1.1 은 기본이 지속 연결, 1.0 은 keep-alive 를 요청했을 때만.
+ * tiny 는 요청 본문을 읽지 않으므로 본문이 있는 요청 뒤에는 다음 요청의 경계를 몰라 닫는다
+ */
+static int keep_alive(const hp_request_t *hp)
 {
-  char buf[MAXLINE];
+  const hp_str_t *v;
+  int keep = hp->minor >= 1;
+
+  if ((v = hp_header(hp, "Connection")) != NULL) {
+    if (has_token(v->p, "close"))
+      keep = 0;
+    else if (has_token(v->p, "keep-alive"))
+      keep = 1;
+  }
+  if (((v = hp_header(hp, "Content-Length")) != NULL && strtoul(v->p, NULL, 10) > 0) ||
+      hp_header(hp, "Transfer-Encoding") != NULL)
+    keep = 0;
+  return keep;
+}
 
-  Rio_readlineb(rp, buf, MAXLINE);
-  while (strcmp(buf, "\r\n")) { // HTTP 헤더의 끝은 빈줄(\r\n)
-    Rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf);
+/* 콤마로 구분된 헤더 값 목록에 token이 있는지 (대소문자 무시) */
+static int has_token(const char *value, const char *token)
+{
+  size_t len = strlen(token);
+
+  while (*value) {
+    while (*value == ' ' || *value == '\t' || *value == ',')
+      value++;
+    if (!strncasecmp(value, token, len) &&
+        (value[len] == '\0' || strchr(" \t,\r\n", value[len])))
+      return 1;
+    while (*value && *value != ',')
+      value++;
   }
-  return;
+  return 0;
 }
 
 /* HTTP URI를 분석한다. */
@@ -177,49 +545,224 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
   }
 }
 
-/* 정적 컨텐츠를 클라이언트에게 서비스한다. */
-void serve_static(int fd, char *filename, int filesize, int is_haed)
+/*
+ * 정적 컨텐츠를 클라이언트에게 서비스한다(연결의 응답으로 쌓는다). 연결을 유지해도 되면 keep.
+ * f 는 c->file 로 잡혀 있어 응답을 다 보낸 뒤에 놓인다.
+ * GET 에 Range 가 있으면 (If-Range 가 맞을 때) 그 구간만 206 으로 보낸다
+ */
+int serve_static(conn_t *c, char *filename, fdc_file_t *f, int is_haed, int keep)
+{
+  char buf[FDC_HEAD_MAX];
+  const char *conn = keep ? keep_hdr : close_hdr;
+  size_t headlen;
+  const hp_str_t *range;
+  byterange_t r[RANGE_MAX];
+  int n;
+
+  /* 형식이 틀리거나 구간이 너무 많은 Range 는 무시하고 전체를 보낸다 */
+  if (!is_haed && (range = hp_header(&c->hp, "Range")) != NULL && if_range_ok(&c->hp, &f->st) &&
+      (n = parse_ranges(range->p, f->st.st_size, r, RANGE_MAX)) >= 0)
+    return serve_ranges(c, filename, f, r, n, keep);
+
+  /* 헤더는 캐시 항목을 만들 때 만들어 둔다(Connection 줄 앞까지). 없으면(메모리 부족) 여기서 만든다 */
+  if (f->head == NULL) {
+    if ((headlen = static_head(filename, &f->st, buf, sizeof(buf))) == 0) {
+      clienterror(c, 0, filename, "500", "Internal Server Error", "Tiny couldn't build the response");
+      return 0;
+    }
+    Rio_writeb(&c->out, buf, headlen);
+  }
+  else
+    Rio_writeb(&c->out, f->head, f->headlen);
+  Rio_writeb(&c->out, conn, strlen(conn));
+  printf("Response headers:\n");
+  printf("%.*s", (int)c->out.rio_len, c->out.rio_buf);
+
+  /*
+   * HEAD 요청이면 바디 전송 생략. 메모리에 올린 작은 파일은 헤더와 내용을 writev 한 번으로,
+   * 나머지는 시작할 때 고른 전략이 헤드와 본문을 같이 보낸다 (conn_flush)
+   */
+  out_add(c, c->out.rio_buf, c->out.rio_len, 0, is_haed ? 0 : f->st.st_size);
+  return keep;
+}
+
+/*
+ * Range 요청에 답한다. 구간이 하나면 Content-Range 를 붙인 206, 여럿이면 multipart/byteranges,
+ * 하나도 파일 안에 없으면(n == 0) 416. 구간마다 조각 하나를 쌓고, 본문은 오프셋부터
+ * serve 전략(또는 메모리의 내용)으로 나간다
+ */
+static int serve_ranges(conn_t *c, char *filename, fdc_file_t *f, const byterange_t *r, int n, int keep)
 {
-  int srcfd;
-  char *srcp, filetype[MAXLINE], buf[MAXBUF];
+  char filetype[MAXLINE], date[64], etag[64], boundary[48];
+  const char *conn = keep ? keep_hdr : close_hdr;
+  long long size = f->st.st_size, total = 0;
+  size_t partoff[RANGE_MAX + 1];  /* parts 안에서 각 파트 헤더가 시작하는 곳. 마지막은 닫는 경계 */
+  rio_writer_t parts;
+  size_t headlen;
+  int i;
+
+  if (n == 0) {
+    Rio_printfb(&c->out, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                         "Server: Tiny Web Server\r\n"
+                         "Content-Range: bytes */%lld\r\n"
+                         "Content-length: 0\r\n%s", size, conn);
+    printf("Response headers:\n%.*s", (int)c->out.rio_len, c->out.rio_buf);
+    out_add(c, c->out.rio_buf, c->out.rio_len, 0, 0);
+    return keep;
+  }
 
-  /* MIME 추출 -> Send response headers to client */
   get_filetype(filename, filetype);
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-  sprintf(buf, "%sConnection: close\r\n", buf);
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-  Rio_writen(fd, buf, strlen(buf));
-  printf("Response headers:\n");
-  printf("%s", buf);
+  validators(&f->st, date, sizeof(date), etag, sizeof(etag));
+  rio_writeinitb(&parts, c->fd);
+  Rio_printfb(&c->out, "HTTP/1.1 206 Partial Content\r\n"
+                       "Server: Tiny Web Server\r\n"
+                       "Accept-Ranges: bytes\r\n"
+                       "Last-Modified: %s\r\n"
+                       "ETag: %s\r\n", date, etag);
+  if (n == 1) {
+    Rio_printfb(&c->out, "Content-Range: bytes %lld-%lld/%lld\r\n"
+                         "Content-length: %lld\r\n"
+                         "Content-type: %s\r\n%s",
+                (long long)r[0].off, (long long)(r[0].off + r[0].len - 1), size,
+                (long long)r[0].len, filetype, conn);
+    partoff[0] = partoff[1] = 0;
+  }
+  else {
+    /* 파트 헤더를 먼저 만들어야 전체 길이를 안다. 경계는 파일 내용에 나올 일이 없을 만큼 길게 */
+    snprintf(boundary, sizeof(boundary), "TINY%016llx%08lx",
+             (unsigned long long)f->st.st_ino ^ (unsigned long long)f->st.st_mtime, random());
+    for (i = 0; i < n; i++) {
+      partoff[i] = parts.rio_len;
+      Rio_printfb(&parts, "\r\n--%s\r\n"
+                          "Content-type: %s\r\n"
+                          "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                  boundary, filetype, (long long)r[i].off, (long long)(r[i].off + r[i].len - 1), size);
+      total += r[i].len;
+    }
+    partoff[n] = parts.rio_len;
+    Rio_printfb(&parts, "\r\n--%s--\r\n", boundary);
+    total += parts.rio_len;
+    Rio_printfb(&c->out, "Content-length: %lld\r\n"
+                         "Content-type: multipart/byteranges; boundary=%s\r\n%s",
+                total, boundary, conn);
+  }
+  printf("Response headers:\n%.*s", (int)c->out.rio_len, c->out.rio_buf);
+
+  /* 응답 헤더 뒤에 파트 헤더들을 이어 두고, 첫 구간은 응답 헤더와, 나머지는 자기 파트 헤더와 함께 보낸다 */
+  headlen = c->out.rio_len;
+  Rio_writeb(&c->out, parts.rio_buf, parts.rio_len);
+  rio_writefreeb(&parts);
+  out_add(c, c->out.rio_buf, headlen + partoff[1], r[0].off, r[0].len);
+  for (i = 1; i < n; i++)
+    out_add(c, c->out.rio_buf + headlen + partoff[i], partoff[i + 1] - partoff[i], r[i].off, r[i].len);
+  if (n > 1)
+    out_add(c, c->out.rio_buf + headlen + partoff[n], c->out.rio_len - headlen - partoff[n], 0, 0);
+  return keep;
+}
+
+/*
+ * "bytes=0-99,200-,-500" 같은 Range 값을 size 바이트 파일의 구간들로 바꾼다.
+ * 파일 밖에서 시작하는 구간은 빼고 끝이 넘치는 구간은 파일 끝에서 자른다. 구간 수를 돌려주며
+ * 0 이면 만족할 수 있는 구간이 없다(416). 형식이 틀렸거나 구간이 max 개를 넘거나,
+ * 여러 구간의 합이 파일보다 크면(겹치는 구간으로 응답을 부풀리는 요청) -1: 전체를 보낸다
+ */
+static int parse_ranges(const char *spec, off_t size, byterange_t *r, int max)
+{
+  long long first, last, sum = 0;
+  char *end;
+  int n = 0;
+
+  if (strncasecmp(spec, "bytes=", 6))
+    return -1;
+  spec += 6;
+  while (1) {
+    while (*spec == ' ' || *spec == '	')
+      spec++;
+    if (*spec == '-') { /* -N: 마지막 N 바이트 */
+      if (!isdigit((unsigned char)spec[1]))
+        return -1;
+      last = strtoll(spec + 1, &end, 10);
+      first = last < size ? size - last : 0;
+      last = last > 0 ? size - 1 : -1;  /* -0 은 만족할 수 없다 */
+    }
+    else {
+      if (!isdigit((unsigned char)*spec))
+        return -1;
+      first = strtoll(spec, &end, 10);
+      if (*end++ != '-')
+        return -1;
+      if (!isdigit((unsigned char)*end))
+        last = size - 1;
+      else if ((last = strtoll(end, &end, 10)) < first)
+        return -1;
+      if (last >= size)
+        last = size - 1;
+    }
+    if (first < size && first <= last) {
+      if (n == max)
+        return -1;
+      r[n].off = first;
+      r[n].len = last - first + 1;
+      sum += r[n++].len;
+    }
+    spec = end;
+    while (*spec == ' ' || *spec == '	')
+      spec++;
+    if (*spec == '\0')
+      break;
+    if (*spec++ != ',')
+      return -1;
+  }
+  return n > 1 && sum > size ? -1 : n;
+}
 
-  /* HEAD 요청이면 바디 전송 생략 */
-  if (is_haed) return;
+/*
+ * If-Range 가 없거나 지금 파일의 검증자와 같으면 1. 다르면 그 사이 파일이 바뀐 것이니
+ * 구간 대신 전체를 보내야 한다. ETag 는 강한 비교(W/ 는 맞지 않는다), 날짜는 Last-Modified 와 그대로 비교
+ */
+static int if_range_ok(const hp_request_t *hp, const struct stat *st)
+{
+  const hp_str_t *v;
+  char date[64], etag[64];
 
-  /* Send response body to client */
-  srcfd = Open(filename, O_RDONLY, 0);
+  if ((v = hp_header(hp, "If-Range")) == NULL)
+    return 1;
+  validators(st, date, sizeof(date), etag, sizeof(etag));
+  return !strcmp(v->p, v->p[0] == '"' ? etag : date);
+}
 
-  /* mmap으로 매핑 후 Rio_writen으로 본문 전송 */
-  srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0); // 파일을 가상메모리에 매핑(읽기 없음)
-  Close(srcfd);
-  Rio_writen(fd, srcp, filesize); // 유저->커널 복사1회
-  Munmap(srcp, filesize);
+/* 파일의 검증자: Last-Modified 날짜와 inode-크기-mtime 으로 만든 ETag */
+static void validators(const struct stat *st, char *date, size_t datesize, char *etag, size_t etagsize)
+{
+  struct tm tm;
 
-  /* malloc + rio_readn + rio_writen */
-  srcp = (char *)Malloc((size_t)filesize); // 힙 버퍼 확보
-  ssize_t nread = Rio_readn(srcfd, srcp, (size_t)filesize); // 커널->유저 복사1회
-  Close(srcfd);
-  Rio_writen(fd, srcp, (size_t)nread); // 유저->커널 복사2회
-  Free(srcp);
+  gmtime_r(&st->st_mtime, &tm);
+  strftime(date, datesize, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  snprintf(etag, etagsize, "\"%lx-%llx-%llx\"",
+           (unsigned long)st->st_ino, (unsigned long long)st->st_size, (unsigned long long)st->st_mtime);
+}
 
-  /*
-      mmap:   파일 내용을 명시적으로 읽지 않아도(read 호출 없음) "메모리에 매핑된 주소"를
-              rio_writen이 참조하는 순간 페이지 폴트로 커널이 파일 페이지를 올려주고, 유저->커널 한 번 복사만으로 소켓으로 간다.
-              
-      malloc: malloc으로 만든 버퍼는 비어 있으니, 먼저 파일 FD에서 유저 버퍼로 읽기(rio_readn)를 해야 하고,
-              이어서 유저->커널로 쓰기(rio_writen)를 해야 한다(복사가 한 번 더 생김). 
-  */
+/*
+ * 정적 파일의 응답 헤더. 파일이 바뀌지 않는 동안 같으므로 fd 캐시가 항목마다 한 번 만든다.
+ * 검증자(Last-Modified, inode-크기-mtime 으로 만든 ETag)를 함께 보낸다.
+ * 연결마다 다른 Connection 줄과 끝의 빈 줄은 보낼 때 붙인다. 길이, 넘치면 0
+ */
+static size_t static_head(const char *filename, const struct stat *st, char *buf, size_t size)
+{
+  char filetype[MAXLINE], date[64], etag[64];
+  int n;
+
+  get_filetype((char *)filename, filetype);
+  validators(st, date, sizeof(date), etag, sizeof(etag));
+  n = snprintf(buf, size, "HTTP/1.1 200 OK\r\n"
+                          "Server: Tiny Web Server\r\n"
+                          "Accept-Ranges: bytes\r\n"
+                          "Content-length: %lld\r\n"
+                          "Content-type: %s\r\n"
+                          "Last-Modified: %s\r\n"
+                          "ETag: %s\r\n",
+               (long long)st->st_size, filetype, date, etag);
+  return n < 0 || (size_t)n >= size ? 0 : n;
 }
 
 /* Derive file type from filename */
@@ -252,14 +795,21 @@ fork로 자식 생성 -> QUERY_STRING 환경변수 세팅 -> dup2(fd, STDOUT)로
 */
 void serve_dynamic(int fd, char *filename, char *cgiargs)
 {
-  char buf[MAXLINE], *emptylist[] = { NULL };
+  char *emptylist[] = { NULL };
+  rio_writer_t hdr;
 
   /* Return first part of HTTP response 
-  응답 헤더만 먼저 전송, CGI가 생성할 바디는 표준출력 -> 소켓으로 나감. */
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Server: Tiny Web Server\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  응답 헤더만 먼저 전송, CGI가 생성할 바디는 표준출력 -> 소켓으로 나감.
+  CGI 는 소켓에 직접 쓰고 EAGAIN 을 모르므로 블로킹으로 되돌린다 (응답 뒤에 연결을 닫는다) */
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  rio_writeinitb(&hdr, fd);
+  Rio_printfb(&hdr, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\nConnection: close\r\n");
+  if (rio_flushb(&hdr) < 0) {  // 두 줄을 한 번에. 자식이 쓰기 전에 내보내야 한다
+    fprintf(stderr, "write error: %s\n", strerror(errno));  // 클라이언트가 먼저 끊었다: 이 연결만 닫는다
+    rio_writefreeb(&hdr);
+    return;
+  }
+  rio_writefreeb(&hdr);
 
   /* for/exec + 환경변수 + 리다이렉트 */
   if (Fork() == 0) { /* Child */